@@ -34,6 +34,19 @@ TARGETS += cmsis
 
 PRIMARY_EXT = .axf
 
+# optional compression of the .data load image, the startup code unpacks it
+# .sig is moved to follow the compressed image, but __data_load_end keeps pointing
+# to the end of the uncompressed one, see tools/datacompress/datacompress.py
+ifeq (1,$(CORTEX_DATA_COMPRESS))
+DEFINES += CORTEX_DATA_COMPRESSION=1
+IMAGE_OUTPUT = $(OUTPUT).dlz$(PRIMARY_EXT)
+
+$(IMAGE_OUTPUT): $(PRIMARY_OUTPUT)
+	python3 $(CORTEX_M_DIR)tools/datacompress/datacompress.py --objcopy $(OBJCOPY) $< $@
+else
+IMAGE_OUTPUT = $(PRIMARY_OUTPUT)
+endif
+
 # we also generate a raw binary image for direct flashing
 .PHONY: binary ihex srec
 
@@ -43,11 +56,11 @@ ihex: $(OUTPUT).hex
 
 srec: $(OUTPUT).s37
 
-$(OUTPUT).bin: $(PRIMARY_OUTPUT)
+$(OUTPUT).bin: $(IMAGE_OUTPUT)
 	$(OBJCOPY) -O binary $< $@
 
-$(OUTPUT).s37: $(PRIMARY_OUTPUT)
+$(OUTPUT).s37: $(IMAGE_OUTPUT)
 	$(OBJCOPY) -O srec --srec-forceS3 $< $@
 
-$(OUTPUT).hex: $(PRIMARY_OUTPUT)
+$(OUTPUT).hex: $(IMAGE_OUTPUT)
 	$(OBJCOPY) -O ihex $< $@
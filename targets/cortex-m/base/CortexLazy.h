@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2026 triaxis s.r.o.
+ * Licensed under the MIT license. See LICENSE.txt file in the repository root
+ * for full license information.
+ *
+ * cortex-m/base/CortexLazy.h
+ *
+ * Static object constructed on first access instead of by a static constructor
+ *
+ * The wrapper itself has no constructor, so it lives in .bss and adds nothing to .init_array.
+ * The object is constructed by the first Get(), or ahead of time by a deferred initializer:
+ *
+ *   static Cortex_Lazy<UsbStack> usb;
+ *   CORTEX_DEFERRED_INIT(usbInit, 10, [] { usb.Get(); });
+ *
+ * Construction is not synchronized, the first access must not race with another one.
+ */
+
+#pragma once
+
+#include <base/base.h>
+
+#include <new>
+
+template<typename T> class Cortex_Lazy
+{
+    alignas(T) uint8_t storage[sizeof(T)];
+    bool constructed;
+
+public:
+    //! Gets the object, constructing it if this is the first access
+    ALWAYS_INLINE T& Get()
+    {
+        if (!constructed)
+        {
+            Construct();
+        }
+        return *(T*)storage;
+    }
+
+    //! Checks if the object has been constructed already
+    bool IsConstructed() const { return constructed; }
+
+    T* operator ->() { return &Get(); }
+    T& operator *() { return Get(); }
+
+private:
+    __attribute__((noinline)) void Construct()
+    {
+        constructed = true;
+        new(storage) T();
+    }
+};
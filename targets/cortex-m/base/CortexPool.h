@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2026 triaxis s.r.o.
+ * Licensed under the MIT license. See LICENSE.txt file in the repository root
+ * for full license information.
+ *
+ * cortex-m/base/CortexPool.h
+ *
+ * Fixed-size object pool with lock-free allocation, usable from any priority level
+ *
+ * Storage for all objects is carved from malloc_once() when the pool is constructed.
+ * Free objects form a stack, whose head is kept in a single word together with a tag
+ * counter incremented on every change, so that LDREX/STREX can update it atomically
+ * without being fooled by a pop-push sequence racing with the update (ABA).
+ */
+
+#pragma once
+
+#include <base/base.h>
+
+#include <new>
+
+#if !(__ARM_FEATURE_LDREX & 4)
+#error Cortex_Pool requires LDREX/STREX support (ARMv7-M or ARMv8-M mainline)
+#endif
+
+template<typename T, size_t N> class Cortex_Pool
+{
+    static_assert(N > 0 && N < 0x10000, "pool capacity must fit in the 16-bit index part of the head");
+
+    union Slot
+    {
+        uint32_t next;      //!< 1-based index of the next free slot, valid only while the slot is free
+        alignas(T) uint8_t data[sizeof(T)];
+    };
+
+    Slot* slots;
+    uint32_t head;          //!< tag in the upper halfword, 1-based index of the first free slot in the lower one
+
+    static constexpr uint32_t IndexMask = 0xFFFF;
+    static constexpr uint32_t TagIncrement = 0x10000;
+
+public:
+    Cortex_Pool()
+    {
+        auto mem = (uintptr_t)malloc_once(sizeof(Slot) * N + alignof(Slot) - 1);
+        ASSERT(mem);
+        slots = (Slot*)((mem + alignof(Slot) - 1) & ~(alignof(Slot) - 1));
+        for (size_t i = 0; i < N; i++)
+        {
+            slots[i].next = i + 2 <= N ? i + 2 : 0;
+        }
+        head = 1;
+    }
+
+    //! Allocates storage for a single object, returns NULL if the pool is exhausted
+    T* Allocate()
+    {
+        uint32_t cur;
+        Slot* slot;
+        do
+        {
+            cur = __LDREXW(&head);
+            uint32_t index = cur & IndexMask;
+            if (!index)
+            {
+                __CLREX();
+                return NULL;
+            }
+            slot = &slots[index - 1];
+            cur = ((cur & ~IndexMask) + TagIncrement) | slot->next;
+        } while (__STREXW(cur, &head));
+        return (T*)slot->data;
+    }
+
+    //! Returns the storage of an object to the pool
+    void Free(T* obj)
+    {
+        ASSERT(Contains(obj));
+        Slot* slot = (Slot*)obj;
+        uint32_t index = slot - slots + 1;
+        uint32_t cur;
+        do
+        {
+            cur = __LDREXW(&head);
+            slot->next = cur & IndexMask;
+            cur = ((cur & ~IndexMask) + TagIncrement) | index;
+        } while (__STREXW(cur, &head));
+    }
+
+    //! Allocates and constructs an object, returns NULL if the pool is exhausted
+    template<typename... Args> T* New(Args&&... args)
+    {
+        T* obj = Allocate();
+        return obj ? new(obj) T(static_cast<Args&&>(args)...) : NULL;
+    }
+
+    //! Destroys an object and returns its storage to the pool
+    void Delete(T* obj)
+    {
+        if (obj)
+        {
+            obj->~T();
+            Free(obj);
+        }
+    }
+
+    //! Checks if the pointer refers to an object allocated from this pool
+    bool Contains(const void* ptr) const { return ptr >= slots && ptr < slots + N; }
+    //! Gets the total number of objects that can be allocated from the pool
+    constexpr size_t Capacity() const { return N; }
+};
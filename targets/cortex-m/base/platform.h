@@ -138,4 +138,76 @@ using Cortex_CriticalContext = Cortex_PriorityContext<CORTEX_WORKER_PRIO>;
 #include <base/Delegate.h>
 extern void Cortex_SetIRQHandler(IRQn_Type IRQn, Delegate<void> handler);
 
+#if CORTEX_BOOT_PROFILE
+
+#ifndef CORTEX_BOOT_PROFILE_CLOCK
+//! Free-running core clock cycle counter used to measure the boot, platforms without DWT provide their own
+#define CORTEX_BOOT_PROFILE_CLOCK()     (DWT->CYCCNT)
+#endif
+
+//! Durations of initialization functions measured during startup, CORTEX_BOOT_PROFILE is the number of entries
+struct Cortex_BootProfile
+{
+    uint32_t hwinit;        //!< number of entries belonging to CORTEX_PREINIT functions, static constructors follow
+    uint32_t count;         //!< number of valid entries
+    uint32_t main;          //!< core clock cycles from reset to main()
+    struct
+    {
+        cortex_handler_t fn;
+        uint32_t cycles;
+    } entries[CORTEX_BOOT_PROFILE];
+};
+
+extern Cortex_BootProfile __boot_profile;
+
+//! Dumps the measured boot profile to the debug output, one line with the address and duration per function
+//! The target has no symbol table, pipe the output to tools/bootprofile/bootprofile.py firmware.elf to resolve the names
+extern void Cortex_BootProfileDump();
+
+#endif
+
+//! Initializer taken out of the static constructors, executed on first access or when the application is idle
+//! Run() may be called from the main context and from workers, but not from interrupt handlers
+struct Cortex_DeferredInit
+{
+    enum State : uint8_t { Pending, Running, Done };
+
+    void (*fn)();
+    volatile State state;
+
+    //! Runs the initializer unless it already ran, returns true if it was run now
+    bool Run() { return state != Done && RunPending(); }
+
+private:
+    bool RunPending();
+};
+
+//! Registers a deferred initializer, ordered like CORTEX_PREINIT functions, call name.Run() before first access
+#define CORTEX_DEFERRED_INIT(name, order, function) \
+Cortex_DeferredInit name = { function }; \
+static __attribute__((used, section(".rospec.deferred.fn." #order))) Cortex_DeferredInit* const UNIQUE(__deferred) = &name
+
+//! Runs the next pending deferred initializer, returns false if there are none left (e.g. from an idle task)
+extern bool Cortex_DeferredInitStep();
+//! Runs all pending deferred initializers
+extern void Cortex_DeferredInitAll();
+
+//! Handler called directly from the vector table, bypassing the Delegate dispatch in Interrupt_Handler
+//! the target object and method are baked into the stub, so the method can be inlined completely
+template<auto Target, auto Method> void Cortex_DirectIRQStub() { (Target->*Method)(); }
+
+//! Installs a handler calling a method of an object with static storage directly from the vector table
+template<auto Target, auto Method> ALWAYS_INLINE void Cortex_SetDirectIRQHandler(IRQn_Type IRQn)
+    { Cortex_SetIRQHandler(IRQn, &Cortex_DirectIRQStub<Target, Method>); }
+
+//! Direct vector table handler for a target known only at runtime, the stub is generated for each IRQ
+template<IRQn_Type IRQn, typename T, void (T::*Method)()> struct Cortex_DirectIRQ
+{
+    static inline T* target;
+    static void Handler() { (target->*Method)(); }
+
+    //! Installs the handler calling the method of the specified object
+    static void Set(T* t) { target = t; Cortex_SetIRQHandler(IRQn, &Handler); }
+};
+
 #endif
@@ -31,6 +31,9 @@ public:
         { SetHandler(Delegate(target, method)); }
     template<class T> ALWAYS_INLINE void SetHandler(const T* target, void (T::*method)() const) const
         { SetHandler(Delegate(target, method)); }
+    //! Calls the method of an object with static storage directly from the vector table
+    template<auto Target, auto Method> ALWAYS_INLINE void SetDirectHandler() const
+        { Cortex_SetDirectIRQHandler<Target, Method>(num); }
     ALWAYS_INLINE void ResetHandler() const { Cortex_ResetIRQHandler(num); }
     ALWAYS_INLINE const void* HandlerArgument() const { return Cortex_GetIRQHandlerArg(num); }
 };
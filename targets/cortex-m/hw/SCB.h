@@ -30,6 +30,8 @@ public:
     void EnableFPU()
     {
         CPACR |= 0x00F00000;
+        // FP context is stacked only for code that actually uses the FPU, and only when needed
+        FPU->FPCCR |= FPU_FPCCR_ASPEN_Msk | FPU_FPCCR_LSPEN_Msk;
         __DSB();
         __ISB();
     }
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2026 triaxis s.r.o.
+ * Licensed under the MIT license. See LICENSE.txt file in the repository root
+ * for full license information.
+ *
+ * cortex-m/kernel/CortexStackPool.h
+ *
+ * Worker stack allocator with a few preallocated size classes
+ *
+ * Stacks of all classes are carved from malloc_once() when the pool is constructed, so workers
+ * spawned often do not churn large blocks through the heap. Free stacks of each class form
+ * a list linked through their first word, making both allocation and release O(1).
+ * When no stack of a sufficient size is available, Allocate() returns NULL and the worker
+ * falls back to a heap allocated stack.
+ *
+ *   static CortexStackPool<2> stacks({ { 1024, 4 }, { 4096, 1 } });
+ *   ... WorkerOptions with .stackAlloc = &stacks
+ */
+
+#pragma once
+
+#include <kernel/kernel.h>
+
+#include <malloc_internal.h>
+
+#ifndef CORTEX_STACK_POOL_ALIGN
+#if CORTEX_WORKER_MPU_STACK_GUARD
+//! Stacks are aligned to the MPU guard region, so it covers exactly the bottom of the stack
+#define CORTEX_STACK_POOL_ALIGN     32
+#else
+#define CORTEX_STACK_POOL_ALIGN     8
+#endif
+#endif
+
+namespace kernel
+{
+
+//! Size class of a CortexStackPool
+struct CortexStackClass
+{
+    uint32_t size;          //!< size of each stack, rounded up to the pool alignment
+    uint32_t count;         //!< number of preallocated stacks
+};
+
+//! Usage statistics of a single size class
+struct CortexStackClassStats
+{
+    uint32_t hits;          //!< stacks allocated from this class
+    uint32_t inUse;         //!< stacks currently allocated
+    uint32_t peak;          //!< highest number of stacks allocated at once
+};
+
+template<size_t NClasses> class CortexStackPool : public WorkerStackAllocator
+{
+    struct Bin
+    {
+        uint8_t* start;     //!< storage of all stacks of the class
+        uint8_t* end;
+        uint32_t size;
+        void* free;         //!< first free stack, linked through the first word
+        CortexStackClassStats stats;
+    };
+
+    Bin bins[NClasses];
+    uint32_t misses = 0;    //!< allocations that could not be served from the pool
+
+public:
+    //! Preallocates the stacks, classes must be sorted by size
+    CortexStackPool(const CortexStackClass (&classes)[NClasses], size_t align = CORTEX_STACK_POOL_ALIGN)
+    {
+        for (size_t i = 0; i < NClasses; i++)
+        {
+            Bin& bin = bins[i];
+            ASSERT(!i || classes[i].size >= classes[i - 1].size);
+            bin.size = (classes[i].size + align - 1) & ~(align - 1);
+            bin.start = (uint8_t*)malloc_once_aligned(align, bin.size * classes[i].count);
+            ASSERT(bin.start);
+            bin.end = bin.start + bin.size * classes[i].count;
+            bin.free = NULL;
+            bin.stats = {};
+            for (uint8_t* p = bin.end; p > bin.start; )
+            {
+                p -= bin.size;
+                *(void**)p = bin.free;
+                bin.free = p;
+            }
+        }
+    }
+
+    //! Allocates a stack from the smallest class that has a free one, returns NULL if there is none
+    void* Allocate(size_t size)
+    {
+        PLATFORM_CRITICAL_SECTION();
+
+        for (Bin& bin : bins)
+        {
+            if (bin.size >= size && bin.free)
+            {
+                void* res = bin.free;
+                bin.free = *(void**)res;
+                bin.stats.hits++;
+                if (++bin.stats.inUse > bin.stats.peak)
+                {
+                    bin.stats.peak = bin.stats.inUse;
+                }
+                return res;
+            }
+        }
+
+        misses++;
+        return NULL;
+    }
+
+    //! Returns a stack to its class
+    void Free(void* stack)
+    {
+        PLATFORM_CRITICAL_SECTION();
+
+        for (Bin& bin : bins)
+        {
+            if (stack >= bin.start && stack < bin.end)
+            {
+                *(void**)stack = bin.free;
+                bin.free = stack;
+                bin.stats.inUse--;
+                return;
+            }
+        }
+
+        ASSERT(false);  // not allocated from this pool
+    }
+
+    //! Gets the statistics of the specified size class
+    const CortexStackClassStats& ClassStats(size_t index) const { return bins[index].stats; }
+    //! Gets the number of allocations that fell back to the heap
+    uint32_t Misses() const { return misses; }
+
+    //! Dumps the pool statistics to the debug output
+    void DumpStats() const
+    {
+        for (const Bin& bin : bins)
+        {
+            DBGCL("stackpool", "%u x %u: %u hits, %u in use, peak %u", (bin.end - bin.start) / bin.size, bin.size, bin.stats.hits, bin.stats.inUse, bin.stats.peak);
+        }
+        DBGCL("stackpool", "%u misses", misses);
+    }
+};
+
+}
@@ -9,6 +9,8 @@
 #include <kernel/kernel.h>
 
 static constexpr uint32_t STACK_MAGIC = ID("STAK");
+static constexpr uint32_t EXC_RETURN_FTYPE = BIT(4);    // clear if the exception frame includes the FP context
+static constexpr uint32_t EXC_RETURN_SPSEL = BIT(2);    // set when returning to PSP
 
 //#define WORKER_TRACE_ENTRY_EXIT 1
 
@@ -21,15 +23,149 @@ __attribute__((naked, noreturn)) static void WorkerDone()
     __asm volatile("svc #0");
 }
 
-typedef void (*handler_t)(void);
-extern "C" handler_t g_isrTableSys[];
-extern "C" void Missing_Handler();
-
+static void StartWorker();
 static void StopWorker();
+#if !CORTEX_WORKER_SCHEDULER
 static void StopWorker2();
 static void StopWorker3(intptr_t asyncVal, AsyncResult asyncRes);
+#endif
 static void StartWorker2(bool noPreempt);
 
+#if CORTEX_WORKER_ACCOUNTING
+
+//! Cycle counter value when the running worker was switched in
+static uint32_t s_switchedIn;
+#if !CORTEX_WORKER_SCHEDULER
+//! Set by StopWorker3 when the worker was stopped by SysTick
+static bool s_preempted;
+#endif
+
+//! Starts measuring the CPU time of a worker being switched in
+static void CpuSwitchIn(CortexWorker* w)
+{
+#ifdef CORTEX_WORKER_TRACE_PORT
+    PLATFORM_DBG_WORD(CORTEX_WORKER_TRACE_PORT, uint32_t(w));
+#endif
+    s_switchedIn = PLATFORM_CYCLE_COUNT;
+}
+
+//! Accounts the CPU time of a worker being switched out
+static void CpuSwitchOut(CortexWorkerCpuStats& cpu, CortexWorker* w, bool preempted)
+{
+    cpu.cycles += PLATFORM_CYCLE_COUNT - s_switchedIn;
+    if (preempted)
+    {
+        cpu.preemptions++;
+    }
+    else
+    {
+        cpu.yields++;
+    }
+#ifdef CORTEX_WORKER_TRACE_PORT
+    // switch-out events have the low bits of the worker address set, 1 when preempted, 2 when yielding
+    PLATFORM_DBG_WORD(CORTEX_WORKER_TRACE_PORT, uint32_t(w) | (preempted ? 1 : 2));
+#endif
+}
+
+#endif
+
+//! Protects the bottom of the worker stack before switching to it
+static ALWAYS_INLINE void GuardStack(uint32_t* stack)
+{
+#if CORTEX_WORKER_STACK_LIMIT
+    // overflow raises a precise UsageFault (STKOF), the limit is placed above the guard word
+    __set_PSPLIM((uint32_t(stack + 1) + 7) & ~7);
+#elif CORTEX_WORKER_MPU_STACK_GUARD
+    uint32_t base = (uint32_t(stack) + 31) & ~31;
+#if defined(__ARM_ARCH_8M_MAIN__) || defined(__ARM_ARCH_8M_BASE__)
+    // ARMv8-M has no no-access permission, a read-only region catches the pushes anyway
+    MPU->RNR = 0;
+    MPU->RBAR = ARM_MPU_RBAR(base, ARM_MPU_SH_NON, 1, 0, 1);
+    MPU->RLAR = ARM_MPU_RLAR((base + 31), 0);
+#else
+    MPU->RBAR = base | MPU_RBAR_VALID_Msk;
+    MPU->RASR = MPU_RASR_ENABLE_Msk | (4 << MPU_RASR_SIZE_Pos);
+#endif
+#endif
+}
+
+//! EXC_RETURN of the context running the workers, the worker always returns to it with the same frame type
+static uint32_t s_mainExcReturn;
+
+//! Set when the main loop reported it is idle before the workers were switched in
+static bool s_mainIdle;
+
+uint32_t CortexWorker::Quantum(bool othersRunnable) const
+{
+    if (!quantum && (othersRunnable || !s_mainIdle))
+    {
+        return CORTEX_WORKER_QUANTUM;
+    }
+    return quantum;
+}
+
+#if CORTEX_WORKER_SCHEDULER
+
+/*!
+ * Round-robin scheduler of preemptible workers
+ *
+ * Workers preempted by SysTick are kept in a run queue and PendSV switches between them directly,
+ * the worker whose RunWorker is waiting in the main context (the owner) can run all of them.
+ * A full round ends when the owner is about to be resumed, then the main loop gets its turn.
+ */
+struct CortexScheduler
+{
+    static CortexWorker* current;   //!< worker running on PSP
+    static CortexWorker* owner;     //!< worker whose RunWorker is waiting in the main context
+    static CortexWorker* head;      //!< first worker in the run queue
+    static CortexWorker* tail;      //!< last worker in the run queue
+
+    static void Enqueue(CortexWorker* w);
+    static CortexWorker* Dequeue();
+    static void Remove(CortexWorker* w);
+    static bool Start(CortexWorker* w);
+    static bool Activate(CortexWorker* w);
+    static uint32_t* Stop(CortexWorker* w, intptr_t asyncVal, AsyncResult asyncRes, uint32_t* mainFrame);
+    static uint32_t* Switch(intptr_t asyncVal, AsyncResult asyncRes, uint32_t* psp, uint32_t* mainFrame);
+
+    static void SwitchContext();
+    static void Tick();
+    static void Preempt();
+};
+
+#endif
+
+/*!
+ * SVC handler installed once for all workers, dispatches on the stack the call was made from:
+ * SVC from the main context (MSP) starts the worker prepared by RunWorker,
+ * SVC from a worker (PSP) yields or completes it
+ */
+__attribute__((naked))
+#ifdef LINKER_ORDERED_SECTION
+__attribute__((section(LINKER_ORDERED_SECTION ".wrk.start.0")))
+#endif
+static void WorkerServiceCall()
+{
+    __asm volatile (
+        "tst lr, %[SPSel]\n"
+        "bne %[StopWorker]\n"
+        // continue in StartWorker
+        // just let it fall through if we can rely on linker ordering
+#ifndef LINKER_ORDERED_SECTION
+        "b %[StartWorker]\n"
+#endif
+        : : [SPSel] "i" (EXC_RETURN_SPSEL), [StopWorker] "g" (StopWorker), [StartWorker] "g" (StartWorker)
+    );
+}
+
+//! The same SVC handler is used for starting and stopping all workers, it is installed only once at startup
+static void InstallWorkerServiceCall()
+{
+    Cortex_SetIRQHandler(SVCall_IRQn, WorkerServiceCall);
+}
+
+CORTEX_PREINIT(0, InstallWorkerServiceCall);
+
 /*!
  * Critical context switching code when stopping/yielding workers (SVC handler)
  * we cannot trust the compiler not to mix up register/stack allocations
@@ -45,12 +181,20 @@ static void StopWorker()
         // been executed right before entering this one, changing the actual registers
         "mrs r2, psp\n"
         "ldrd r0, r1, [r2]\n"
+#if CORTEX_WORKER_SCHEDULER
+        // let the scheduler decide where to continue
+        "b %[SwitchContext]"
+        : : [SwitchContext] "g" (CortexScheduler::SwitchContext)
+#else
         // continue in StopWorker2
         "b %[StopWorker2]"
         : : [StopWorker2] "g" (StopWorker2)
+#endif
     );
 }
 
+#if !CORTEX_WORKER_SCHEDULER
+
 /*!
  * Critical context switching code when interrupting workers (SysTick handler)
  * we cannot trust the compiler not to mix up register/stack allocations
@@ -62,6 +206,10 @@ __attribute__((section(LINKER_ORDERED_SECTION ".wrk.stop.0")))
 static void InterruptWorker()
 {
     __asm volatile (
+        // ignore requests that did not interrupt a worker, see Preempt()
+        "tst lr, %[SPSel]\n"
+        "it eq\n"
+        "bxeq lr\n"
         // just call StopWorker with a yield result, i.e. SleepTicks(0)
         "movs r0, #0\n"
         "movs r1, %[SleepTicks]\n"
@@ -71,7 +219,7 @@ static void InterruptWorker()
 #ifndef LINKER_ORDERED_SECTION
         "b %[StopWorker2]\n"
 #endif
-        : : [SleepTicks] "i" (AsyncResult::SleepTicks), [StopWorker2] "g" (StopWorker2)
+        : : [SPSel] "i" (EXC_RETURN_SPSEL), [SleepTicks] "i" (AsyncResult::SleepTicks), [StopWorker2] "g" (StopWorker2)
     );
 }
 
@@ -87,21 +235,27 @@ __attribute__((section(LINKER_ORDERED_SECTION ".wrk.stop.2")))
 static void StopWorker2()
 {
     __asm volatile (
-        // we'll be returning to MSP
-        "bic lr, #4\n"
         // overwrite the stack R0/R1 values with current ones (async_res_t)
         "strd r0, r1, [sp]\n"
-        // save registers not handled by handler entry below PSP
-        "stmdb r2!, {r4-r11}\n"
+        // save registers not handled by handler entry below PSP, along with EXC_RETURN of the worker
+        "stmdb r2!, {r4-r11, lr}\n"
 #ifndef __SOFTFP__
-        "vstmdb r2!, {s16-s31}\n"
+        // FP registers are saved only if the worker has an active FP context,
+        // touching them also completes the lazy stacking of S0-S15 into the exception frame
+        "tst lr, %[FType]\n"
+        "it eq\n"
+        "vstmdbeq r2!, {s16-s31}\n"
 #endif
+        // we'll be returning to MSP
+        "movw r3, #:lower16:%[mainExcReturn]\n"
+        "movt r3, #:upper16:%[mainExcReturn]\n"
+        "ldr lr, [r3]\n"
         // end of critical part, handle the rest in StopWorker3
         // just let it fall through if we can rely on linker ordering
 #ifndef LINKER_ORDERED_SECTION
         "b %[StopWorker3]"
 #endif
-        : : [StopWorker3] "g" (StopWorker3)
+        : : [StopWorker3] "g" (StopWorker3), [FType] "i" (EXC_RETURN_FTYPE), [mainExcReturn] "i" (&s_mainExcReturn)
     );
 }
 
@@ -119,8 +273,14 @@ static void StopWorker3(intptr_t asyncVal, AsyncResult asyncRes)
     SysTick->CTRL = 0;
     // clear possible pending SysTick in case the stop is called via SVC
     SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk;
+
+#if CORTEX_WORKER_ACCOUNTING
+    s_preempted = __get_IPSR() == SysTick_IRQn + NVIC_USER_IRQ_OFFSET;
+#endif
 };
 
+#endif
+
 /*!
  * Critical context switching code when starting workers (SVC handler)
  * we cannot trust the compiler not to mix up register/stack allocations
@@ -132,22 +292,32 @@ __attribute__((section(LINKER_ORDERED_SECTION ".wrk.start.1")))
 static void StartWorker()
 {
     __asm volatile (
-        // we'll be returning to PSP
-        "orr lr, #4\n"
+        // remember how to return to the main context
+        "movw r3, #:lower16:%[mainExcReturn]\n"
+        "movt r3, #:upper16:%[mainExcReturn]\n"
+        "str lr, [r3]\n"
         // load R0 from PSP because previous handler could have corrupted it
         "ldr r0, [sp]\n"
-        // restore registers not handled by handler return from below PSP
+        // restore registers not handled by handler return from below PSP, along with EXC_RETURN of the worker
         "mrs r2, psp\n"
-        "ldmdb r2!, {r4-r11}\n"
+        "ldmdb r2!, {r4-r12}\n"
 #ifndef __SOFTFP__
-        "vldmdb r2!, {s16-s31}\n"
+        // FP registers were saved only if the worker had an active FP context
+        "tst r12, %[FType]\n"
+        "it eq\n"
+        "vldmdbeq r2!, {s16-s31}\n"
 #endif
+        // we'll be returning to PSP with the frame type of the worker, the rest of EXC_RETURN is kept
+        "and r12, %[FType]\n"
+        "bic lr, %[FType]\n"
+        "orr lr, %[SPSel]\n"
+        "orr lr, r12\n"
         // end of critical part, handle the rest in StartWorker2
         // just let it fall through if we can rely on linker ordering
 #ifndef LINKER_ORDERED_SECTION
         "b %[StartWorker2]"
 #endif
-        : : [StartWorker2] "g" (StartWorker2)
+        : : [StartWorker2] "g" (StartWorker2), [FType] "i" (EXC_RETURN_FTYPE), [SPSel] "i" (EXC_RETURN_SPSEL), [mainExcReturn] "i" (&s_mainExcReturn)
     );
 }
 
@@ -161,51 +331,397 @@ static void StartWorker2(bool noPreempt)
     ITM->PORT[0].u8 = '<';
 #endif
 
-    // change the SVCall handler to StopWorker
-    g_isrTableSys[SVCall_IRQn + NVIC_USER_IRQ_OFFSET] = (handler_t)StopWorker;
-    __DSB();
-    __ISB();
-
     if (!noPreempt)
     {
         SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
     }
 }
 
+#if CORTEX_WORKER_SCHEDULER
+
+CortexWorker* CortexScheduler::current;
+CortexWorker* CortexScheduler::owner;
+CortexWorker* CortexScheduler::head;
+CortexWorker* CortexScheduler::tail;
+
+void CortexScheduler::Enqueue(CortexWorker* w)
+{
+    w->next = NULL;
+    w->queued = true;
+    if (tail)
+    {
+        tail->next = w;
+    }
+    else
+    {
+        head = w;
+    }
+    tail = w;
+}
+
+CortexWorker* CortexScheduler::Dequeue()
+{
+    CortexWorker* w = head;
+    if (w)
+    {
+        head = w->next;
+        if (!head)
+        {
+            tail = NULL;
+        }
+        w->queued = false;
+    }
+    return w;
+}
+
+void CortexScheduler::Remove(CortexWorker* w)
+{
+    PLATFORM_CRITICAL_SECTION();
+
+    CortexWorker* prev = NULL;
+    for (CortexWorker* p = head; p; prev = p, p = p->next)
+    {
+        if (p == w)
+        {
+            (prev ? prev->next : head) = w->next;
+            if (tail == w)
+            {
+                tail = prev;
+            }
+            w->queued = false;
+            return;
+        }
+    }
+}
+
+//! Prepares the worker to be run from its own RunWorker, returns true if it is to be preempted
+bool CortexScheduler::Start(CortexWorker* w)
+{
+    if (w->queued)
+    {
+        Remove(w);
+    }
+    owner = w;
+    return Activate(w);
+}
+
+//! Applies the per-worker settings before the worker is switched in, returns true if it is to be preempted
+bool CortexScheduler::Activate(CortexWorker* w)
+{
+    current = w;
+
+#if CORTEX_WORKER_ACCOUNTING
+    CpuSwitchIn(w);
+#endif
+#if MALLOC_ARENA
+    __malloc_current_arena = &w->arena;
+#endif
+    GuardStack(w->stack);
+
+    // a fresh time slice, SysTick is started by StartWorker2 or Switch
+    // a tickless worker still gets the default one if there are other runnable workers
+    uint32_t quantum = w->Quantum(head);
+    SysTick->LOAD = quantum;
+    SysTick->VAL = 0;
+    return quantum && !w->noPreempt;
+}
+
+//! Returns to the RunWorker of the owner with the specified result
+uint32_t* CortexScheduler::Stop(CortexWorker* w, intptr_t asyncVal, AsyncResult asyncRes, uint32_t* mainFrame)
+{
+    // R0/R1 in the exception frame of the main context become the result of the SVC in RunWorker
+    mainFrame[0] = asyncVal;
+    mainFrame[1] = uint32_t(asyncRes);
+    // RunWorker picks up the stack pointer of the owner from PSP
+    __set_PSP(uint32_t(w->sp));
+
+    SysTick->CTRL = 0;
+    // clear possible pending preemption, it must not hit the main context
+    SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk | SCB_ICSR_PENDSVCLR_Msk;
+    current = NULL;
+    return NULL;
+}
+
+/*!
+ * Decides which worker runs next after the current one yielded or was preempted
+ * returns the PSP of the worker to switch to, or NULL to return to the main context
+ */
+uint32_t* CortexScheduler::Switch(intptr_t asyncVal, AsyncResult asyncRes, uint32_t* psp, uint32_t* mainFrame)
+{
+    CortexWorker* w = current;
+    w->sp = psp;
+
+#if CORTEX_WORKER_ACCOUNTING
+    CpuSwitchOut(w->cpu, w, __get_IPSR() == PendSV_IRQn + NVIC_USER_IRQ_OFFSET);
+#endif
+
+    if (asyncRes == AsyncResult::SleepTicks && !asyncVal)
+    {
+        // preempted or yielding to others, the worker stays runnable
+        Enqueue(w);
+    }
+    else if (w != owner)
+    {
+        // the result belongs to the task of this worker, it gets it from its next RunWorker
+        w->result = _ASYNC_RES(asyncVal, asyncRes);
+        w->hasResult = true;
+    }
+    else
+    {
+        return Stop(w, asyncVal, asyncRes, mainFrame);
+    }
+
+    // the owner is always queued at this point unless it is the current worker
+    CortexWorker* next = Dequeue();
+    if (next == owner)
+    {
+        // the round is complete, the owner remains runnable while the main loop runs
+        Enqueue(next);
+        return Stop(next, 0, AsyncResult::SleepTicks, mainFrame);
+    }
+
+    SysTick->CTRL = Activate(next) ? SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk : 0;
+    return next->sp;
+}
+
+/*!
+ * Critical context switching code shared by the SVC and PendSV handlers
+ * we cannot trust the compiler not to mix up register/stack allocations
+ * expects async_res_t in R0/R1
+ */
+__attribute__((naked)) void CortexScheduler::SwitchContext()
+{
+    __asm volatile (
+        // save registers not handled by handler entry below PSP, along with EXC_RETURN of the worker
+        "mrs r2, psp\n"
+        "mov r12, r2\n"
+        "stmdb r12!, {r4-r11, lr}\n"
+#ifndef __SOFTFP__
+        "tst lr, %[FType]\n"
+        "it eq\n"
+        "vstmdbeq r12!, {s16-s31}\n"
+#endif
+        // MSP points to the exception frame of the main context
+        "mov r3, sp\n"
+        "bl %[Switch]\n"
+        "movw r3, #:lower16:%[mainExcReturn]\n"
+        "movt r3, #:upper16:%[mainExcReturn]\n"
+        "ldr lr, [r3]\n"
+        "cbz r0, 1f\n"
+        // restore the next worker the same way StartWorker does
+        "msr psp, r0\n"
+        "ldmdb r0!, {r4-r12}\n"
+#ifndef __SOFTFP__
+        "tst r12, %[FType]\n"
+        "it eq\n"
+        "vldmdbeq r0!, {s16-s31}\n"
+#endif
+        "and r12, %[FType]\n"
+        "bic lr, %[FType]\n"
+        "orr lr, %[SPSel]\n"
+        "orr lr, r12\n"
+        "1:\n"
+        // returning to the main context otherwise
+        "bx lr\n"
+        : : [Switch] "g" (Switch), [FType] "i" (EXC_RETURN_FTYPE), [SPSel] "i" (EXC_RETURN_SPSEL), [mainExcReturn] "i" (&s_mainExcReturn)
+    );
+}
+
+//! SysTick handler, the time slice of the current worker is over
+void CortexScheduler::Tick()
+{
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+}
+
+//! PendSV handler, switches to the next runnable worker
+__attribute__((naked)) void CortexScheduler::Preempt()
+{
+    __asm volatile (
+        // ignore requests that did not interrupt a worker
+        "tst lr, %[SPSel]\n"
+        "it eq\n"
+        "bxeq lr\n"
+        // preemption is the same as yielding with SleepTicks(0)
+        "movs r0, #0\n"
+        "movs r1, %[SleepTicks]\n"
+        "b %[SwitchContext]\n"
+        : : [SPSel] "i" (EXC_RETURN_SPSEL), [SleepTicks] "i" (AsyncResult::SleepTicks), [SwitchContext] "g" (SwitchContext)
+    );
+}
+
+#else
+
+//! Worker running on PSP
+static CortexWorker* s_current;
+
+#endif
+
+bool CortexWorker::SetQuantum(uint32_t cycles)
+{
+#if CORTEX_WORKER_SCHEDULER
+    CortexWorker* w = CortexScheduler::current;
+#else
+    CortexWorker* w = s_current;
+#endif
+    if (!w || __get_IPSR())
+    {
+        // not running in a worker
+        return false;
+    }
+
+    if (cycles > SysTick_LOAD_RELOAD_Msk)
+    {
+        // SysTick reload value has only 24 bits
+        cycles = SysTick_LOAD_RELOAD_Msk;
+    }
+
+    w->quantum = cycles;
+    if (w->noPreempt)
+    {
+        return true;
+    }
+
+#if CORTEX_WORKER_SCHEDULER
+    cycles = w->Quantum(CortexScheduler::head);
+#else
+    cycles = w->Quantum(false);
+#endif
+
+    // takes effect with the next reload
+    PLATFORM_CRITICAL_SECTION();
+    SysTick->LOAD = cycles;
+    SysTick->CTRL = cycles ? SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk : 0;
+    return true;
+}
+
+void CortexWorker::Preempt()
+{
+    // the SysTick handler ignores the request if no worker is running
+    SCB->ICSR = SCB_ICSR_PENDSTSET_Msk;
+}
+
 OPTIMIZE async(CortexWorker::RunWorker)
 {
-    // change the SVCall handler to StartWorker
-    g_isrTableSys[SVCall_IRQn + NVIC_USER_IRQ_OFFSET] = StartWorker;
+#if CORTEX_WORKER_SCHEDULER
+    if (hasResult)
+    {
+        // the worker already yielded while running on behalf of another one
+        hasResult = false;
+        return Finish(result);
+    }
+
+    s_mainIdle = CORTEX_WORKER_MAIN_IDLE();
+    bool preempt = CortexScheduler::Start(this);
+#else
+    s_mainIdle = CORTEX_WORKER_MAIN_IDLE();
+    uint32_t slice = Quantum(false);
+    bool preempt = slice && !noPreempt;
+    SysTick->LOAD = slice;
+    s_current = this;
+#if CORTEX_WORKER_ACCOUNTING
+    CpuSwitchIn(this);
+#endif
+#endif
 
     // load PSP
     __set_PSP(uint32_t(sp));
-    __DSB();
-    __ISB();
 
-#if CORTEX_WORKER_MPU_STACK_GUARD
-    // make sure the bottom of stack falls in a no access region
-    MPU->RBAR = ((uint32_t(stack) + 31) & ~31) | 0x10;
-    MPU->RASR = MPU_RASR_ENABLE_Msk | (4 << MPU_RASR_SIZE_Pos);
+    GuardStack(stack);
+#if CORTEX_WORKER_MPU_STACK_GUARD && !CORTEX_WORKER_STACK_LIMIT
+    // make sure the bottom of stack falls in a protected region
     MPU->CTRL = MPU_CTRL_ENABLE_Msk | MPU_CTRL_PRIVDEFENA_Msk;
 #endif
 
-    register intptr_t r0 asm ("r0") = noPreempt;
+#if MALLOC_ARENA
+    __malloc_current_arena = &arena;
+#endif
+
+    register intptr_t r0 asm ("r0") = !preempt;
     register AsyncResult r1 asm ("r1");
     __asm volatile (
         // switch to PSP, we get back after yield or interrupt
         "svc #0\n"
-        : "=r" (r0), "=r" (r1) : "r" (r0) : "r4", "r5", "r6", "r7", "r8", "r9", "r10", "r11", "cc", "memory"
+        : "=r" (r0), "=r" (r1) : "r" (r0) : "r4", "r5", "r6", "r7", "r8", "r9", "r10", "r11",
+#ifndef __SOFTFP__
+        // S16-S31 of the worker are loaded only if it has an FP context, the ones of the caller are not preserved
+        "d8", "d9", "d10", "d11", "d12", "d13", "d14", "d15",
+#endif
+        "cc", "memory"
     );
     auto res = _ASYNC_RES(r0, r1);
 
-#if CORTEX_WORKER_MPU_STACK_GUARD
+#if !CORTEX_WORKER_SCHEDULER
+    s_current = NULL;
+#if CORTEX_WORKER_ACCOUNTING
+    CpuSwitchOut(cpu, this, s_preempted);
+#endif
+#endif
+
+#if MALLOC_ARENA
+    __malloc_current_arena = NULL;
+#endif
+
+#if CORTEX_WORKER_MPU_STACK_GUARD && !CORTEX_WORKER_STACK_LIMIT
     MPU->CTRL = 0;
 #endif
-    g_isrTableSys[SVCall_IRQn + NVIC_USER_IRQ_OFFSET] = (handler_t)Missing_Handler;
 
     // store PSP
     sp = (uint32_t*)__get_PSP();
 
+    return Finish(res);
+}
+
+#if CORTEX_WORKER_STACK_CACHE
+
+/*!
+ * Heap allocated stack (of at most CORTEX_WORKER_STACK_CACHE bytes) of a completed worker
+ * kept for the next one, so that short-lived workers started one after another do not allocate at all
+ */
+static uint32_t* s_cachedStack;
+static size_t s_cachedBytes;
+
+//! Takes the cached stack if it is large enough, updating the size to the whole cached stack
+static uint32_t* StackCacheTake(size_t& bytes)
+{
+    PLATFORM_CRITICAL_SECTION();
+
+    uint32_t* res = s_cachedStack;
+    if (!res || s_cachedBytes < bytes)
+    {
+        return NULL;
+    }
+
+    bytes = s_cachedBytes;
+    s_cachedStack = NULL;
+    s_cachedBytes = 0;
+    return res;
+}
+
+//! Keeps the larger of the released and the cached stack, returns the one to be freed
+static uint32_t* StackCachePut(uint32_t* stack, size_t bytes)
+{
+    if (bytes > CORTEX_WORKER_STACK_CACHE)
+    {
+        return stack;
+    }
+
+    PLATFORM_CRITICAL_SECTION();
+
+    if (bytes < s_cachedBytes)
+    {
+        return stack;
+    }
+
+    uint32_t* res = s_cachedStack;
+    s_cachedStack = stack;
+    s_cachedBytes = bytes;
+    return res;
+}
+
+#endif
+
+async_res_t CortexWorker::Finish(async_res_t res)
+{
 #if TRACE
     if (*stack != STACK_MAGIC || sp < stack)
     {
@@ -223,14 +739,37 @@ OPTIMIZE async(CortexWorker::RunWorker)
 
     if (_ASYNC_RES_TYPE(res) <= AsyncResult::Complete)
     {
+#if CORTEX_WORKER_STACK_STATS
+        if (auto stats = stackStats)
+        {
+            size_t peak = StackPeak();
+            if (peak > stats->peak)
+            {
+                stats->peak = peak;
+            }
+            stats->runs++;
+            if (stats->live == this)
+            {
+                stats->live = NULL;
+            }
+        }
+#endif
         if (stackAlloc)
         {
             stackAlloc->Free(stack);
         }
         else
         {
+#if CORTEX_WORKER_STACK_CACHE
+            free(StackCachePut(stack, stackBytes));
+#else
             free(stack);
+#endif
         }
+#if MALLOC_ARENA
+        // release everything the worker allocated from its arena
+        free(arena.start);
+#endif
         MemPoolFreeDynamic(this);
     }
     return res;
@@ -238,18 +777,97 @@ OPTIMIZE async(CortexWorker::RunWorker)
 
 enum
 {
-#ifdef __SOFTFP__
-    ISRStack = 8,           // 8 regular IRS registers
-    BelowStack = 8,         // R4-R11
-#else
-    ISRStack = 8 + 18,      // 8 regular ISR registers + 18 VFP (S0-15, FPSCR, VPR)
-    BelowStack = 8 + 16,    // R4-R11, S16-S31
-#endif
+    // workers start without an FP context, the extended frame and S16-S31 are
+    // stored on the worker stack only after it starts using the FPU
+    ISRStack = 8,           // 8 regular ISR registers
+    BelowStack = 8 + 1,     // R4-R11, EXC_RETURN
 };
 
+#if CORTEX_WORKER_STACK_STATS
+
+static CortexWorkerStackStats s_stackStats[CORTEX_WORKER_STACK_STATS];
+
+//! Finds or creates the statistics record for the specified entry point, returns NULL if the table is full
+static CortexWorkerStackStats* StackStatsFor(void* entry)
+{
+    CortexWorkerStackStats* free = NULL;
+    for (auto& st : s_stackStats)
+    {
+        if (st.entry == entry)
+        {
+            return &st;
+        }
+        if (!st.entry && !free)
+        {
+            free = &st;
+        }
+    }
+    if (free)
+    {
+        free->entry = entry;
+    }
+    return free;
+}
+
+size_t CortexWorker::StackPeak() const
+{
+    // the first word is the guard, the rest is filled when the worker starts
+    size_t words = stackBytes / 4;
+    size_t i = 1;
+    while (i < words && stack[i] == STACK_MAGIC)
+    {
+        i++;
+    }
+    return (words - i) * 4;
+}
+
+const CortexWorkerStackStats* CortexWorker::StackStats(size_t& count)
+{
+    count = sizeof(s_stackStats) / sizeof(s_stackStats[0]);
+    return s_stackStats;
+}
+
+void CortexWorker::DumpStackStats()
+{
+    for (auto& st : s_stackStats)
+    {
+        if (!st.entry)
+        {
+            continue;
+        }
+        size_t peak = st.peak;
+        if (st.live && st.live->StackPeak() > peak)
+        {
+            peak = st.live->StackPeak();
+        }
+        DBGCL("stack", "%p: peak %u of %u (requested %u), %u runs%s", st.entry, peak, st.allocated, st.requested, st.runs, st.live ? ", running" : "");
+    }
+}
+
+#endif
+
 async_once(Worker::Run)
 {
     size_t stackSize = this->stackSize;
+#if CORTEX_WORKER_STACK_STATS
+    auto stats = stackStats = StackStatsFor((void*)run);
+    if (stats)
+    {
+        stats->requested = stackSize;
+#if CORTEX_WORKER_STACK_AUTOSIZE
+        if (stats->runs)
+        {
+            // use the observed peak with some margin, but never more than requested
+            size_t fit = (stats->peak + CORTEX_WORKER_STACK_MARGIN + 7) & ~7;
+            if (fit < stackSize)
+            {
+                stackSize = fit;
+            }
+        }
+#endif
+        stats->live = this;
+    }
+#endif
     void* allocd = NULL;
     if (stackAlloc)
     {
@@ -258,13 +876,28 @@ async_once(Worker::Run)
     if (!allocd)
     {
         stackAlloc = NULL;
-        allocd = malloc(stackSize);
+#if CORTEX_WORKER_STACK_CACHE
+        // reuse the stack of a previously completed worker if possible
+        if (!(allocd = StackCacheTake(stackSize)))
+#endif
+        {
+            allocd = malloc(stackSize);
+        }
     }
+#if CORTEX_WORKER_STACK_STATS || CORTEX_WORKER_STACK_CACHE
+    stackBytes = stackSize;
+#endif
+#if CORTEX_WORKER_STACK_STATS
+    if (stats)
+    {
+        stats->allocated = stackSize;
+    }
+#endif
     size_t stackWords = stackSize / 4;
     stack = (uint32_t*)allocd;
 
     stack[0] = STACK_MAGIC;
-#if TRACE
+#if TRACE || CORTEX_WORKER_STACK_STATS
     for (size_t i = 1; i < stackWords; i++)
     {
         stack[i] = STACK_MAGIC;
@@ -279,13 +912,31 @@ async_once(Worker::Run)
     sp[6] = uint32_t((void*)run) | 1;        // initial PC
     sp[5] = uint32_t(WorkerDone);                 // LR
     sp[0] = uint32_t(this);    // initial R0
+    sp[-1] = EXC_RETURN_FTYPE;  // start with a basic frame
+
+#if CORTEX_WORKER_ACCOUNTING
+    // worker CPU time is measured by the cycle counter
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+#if CORTEX_WORKER_MPU_STACK_GUARD && !CORTEX_WORKER_STACK_LIMIT && (defined(__ARM_ARCH_8M_MAIN__) || defined(__ARM_ARCH_8M_BASE__))
+    // the guard region uses attribute 0, make it normal write-back memory like the rest of the SRAM
+    ARM_MPU_SetMemAttr(0, ARM_MPU_ATTR(ARM_MPU_ATTR_MEMORY_(0, 1, 1, 1), ARM_MPU_ATTR_MEMORY_(0, 1, 1, 1)));
+#endif
 
     // initialize systick
     SysTick->CTRL = 0;
     SysTick->VAL = 0;
-    SysTick->LOAD = SystemCoreClock / 3000;
 
+#if CORTEX_WORKER_SCHEDULER
+    // SysTick only requests the switch, it is performed by PendSV
+    Cortex_SetIRQHandler(SysTick_IRQn, CortexScheduler::Tick);
+    Cortex_SetIRQHandler(PendSV_IRQn, CortexScheduler::Preempt);
+    NVIC_SetPriority(PendSV_IRQn, CORTEX_WORKER_PRIO);
+#else
     Cortex_SetIRQHandler(SysTick_IRQn, InterruptWorker);
+#endif
     // use lowest non-masked priority for SysTick
     // it will be masked in critical sections to prevent preemption
     NVIC_SetPriority(SysTick_IRQn, CORTEX_WORKER_PRIO);
@@ -293,9 +944,35 @@ async_once(Worker::Run)
     return async_forward(Task::Switch, GetDelegate((CortexWorker*)this, &CortexWorker::RunWorker), trySync);
 }
 
+#if MALLOC_ARENA
+
+bool CortexWorker::CreateArena(size_t size)
+{
+    __malloc_arena* a = __malloc_current_arena;
+    if (!a || a->start || __get_IPSR())
+    {
+        // not running in a worker, or it already has an arena
+        return false;
+    }
+
+    // the arena is still empty, so this allocation goes to the heap
+    auto mem = (uint8_t*)malloc(size);
+    if (!mem)
+    {
+        return false;
+    }
+
+    a->start = a->ptr = mem;
+    a->end = mem + size;
+    return true;
+}
+
+#endif
+
 bool Worker::CanAwait()
 {
-    return g_isrTableSys[SVCall_IRQn + NVIC_USER_IRQ_OFFSET] == (handler_t)StopWorker;
+    // workers are the only code running in thread mode on PSP
+    return !__get_IPSR() && (__get_CONTROL() & CONTROL_SPSEL_Msk);
 }
 
 }
@@ -10,6 +10,37 @@
 
 #include <base/base.h>
 
+#if MALLOC_ARENA
+#include <malloc_internal.h>
+#endif
+
+#ifndef CORTEX_WORKER_QUANTUM
+//! Default time slice of preemptible workers in core clock cycles
+#define CORTEX_WORKER_QUANTUM   (SystemCoreClock / 3000)
+#endif
+
+#ifndef CORTEX_WORKER_MAIN_IDLE
+//! Evaluated in the main context before switching to workers, returns true if the main loop has nothing to do
+//! until the workers yield or Preempt() is called - only then can a tickless worker run without SysTick,
+//! otherwise it gets the default time slice so that the timers of the main loop are not delayed
+#define CORTEX_WORKER_MAIN_IDLE()   false
+#endif
+
+#if CORTEX_WORKER_STACK_AUTOSIZE && !defined(CORTEX_WORKER_STACK_STATS)
+//! Number of worker entry points for which stack usage is tracked, automatic sizing needs the statistics
+#define CORTEX_WORKER_STACK_STATS   16
+#endif
+
+#if CORTEX_WORKER_STACK_AUTOSIZE && !defined(CORTEX_WORKER_STACK_MARGIN)
+//! Bytes added to the observed peak stack usage when sizing worker stacks automatically
+#define CORTEX_WORKER_STACK_MARGIN  128
+#endif
+
+#if !defined(CORTEX_WORKER_STACK_LIMIT) && defined(__ARM_ARCH_8M_MAIN__)
+//! ARMv8-M mainline checks worker stacks against PSPLIM, making the MPU stack guard unnecessary
+#define CORTEX_WORKER_STACK_LIMIT   1
+#endif
+
 #ifndef PLATFORM_WORKER_CLASS_BASE
 #define PLATFORM_WORKER_CLASS_BASE    CortexWorker
 #endif
@@ -17,20 +48,110 @@
 namespace kernel
 {
 
+class CortexWorker;
+
+#if CORTEX_WORKER_STACK_STATS
+
+//! Stack usage observed for all workers with the same entry point
+struct CortexWorkerStackStats
+{
+    void* entry;            //!< worker entry point
+    uint32_t requested;     //!< stack size requested for the last worker
+    uint32_t allocated;     //!< stack size actually allocated for the last worker
+    uint32_t peak;          //!< highest stack usage of all completed workers
+    uint32_t runs;          //!< number of completed workers
+    CortexWorker* live;     //!< the last started worker, while it is running
+};
+
+#endif
+
+#if CORTEX_WORKER_ACCOUNTING
+
+//! CPU time used by a worker
+struct CortexWorkerCpuStats
+{
+    uint64_t cycles;        //!< core clock cycles spent running the worker
+    uint32_t yields;        //!< number of times the worker was switched out voluntarily
+    uint32_t preemptions;   //!< number of times the worker was preempted
+};
+
+#endif
+
 class CortexWorker
 {
 private:
     CortexWorker(const WorkerOptions& opts)
-        : stackSize(opts.stack), stackAlloc(opts.stackAlloc), noPreempt(opts.noPreempt), trySync(opts.trySync) {}
+        : stackSize(opts.stack), stackAlloc(opts.stackAlloc), noPreempt(opts.noPreempt), trySync(opts.trySync),
+        quantum(CORTEX_WORKER_QUANTUM) {}
 
     union { size_t stackSize; uint32_t* stack; };
     uint32_t* sp;
     WorkerStackAllocator* stackAlloc;
     bool noPreempt, trySync;
+    uint32_t quantum;           //!< time slice in core clock cycles, zero when running tickless
+#if MALLOC_ARENA
+    __malloc_arena arena = {};
+#endif
+#if CORTEX_WORKER_SCHEDULER
+    CortexWorker* next = NULL;  //!< next worker in the run queue
+    bool queued = false;        //!< the worker is in the run queue
+    bool hasResult = false;     //!< the worker yielded while running on behalf of another one
+    async_res_t result;         //!< the yield result waiting for the next RunWorker
+
+    friend struct CortexScheduler;
+#endif
+#if CORTEX_WORKER_STACK_STATS || CORTEX_WORKER_STACK_CACHE
+    size_t stackBytes;      //!< size of the allocated stack
+#endif
+#if CORTEX_WORKER_STACK_STATS
+    CortexWorkerStackStats* stackStats;
+#endif
+#if CORTEX_WORKER_ACCOUNTING
+    CortexWorkerCpuStats cpu = {};
+#endif
 
     async(RunWorker);
+    //! Returns the time slice to use, tickless workers get the default one unless nothing else needs the CPU
+    uint32_t Quantum(bool othersRunnable) const;
+    //! Checks the stack and releases the worker after it completes
+    async_res_t Finish(async_res_t res);
 
     friend class Worker;
+
+#if MALLOC_ARENA
+public:
+    //! Attaches a bump allocation arena of the specified size to the calling worker
+    //! All further allocations made by the worker are served from the arena (falling back to the heap
+    //! when it is exhausted), and the whole arena is released at once when the worker completes
+    static bool CreateArena(size_t size);
+#endif
+
+public:
+    //! Changes the time slice of the calling worker, in core clock cycles
+    //! The slice is limited to the 24-bit SysTick reload value, longer ones are clamped
+    //! Zero makes the worker run without SysTick interrupts while it is the only runnable worker
+    //! and CORTEX_WORKER_MAIN_IDLE() reported the main loop idle, it is then switched out only
+    //! when it yields or when Preempt() is called
+    static bool SetQuantum(uint32_t cycles);
+    //! Requests the running worker to be switched out, e.g. from an interrupt handler that made work
+    //! pending for the main loop while a tickless worker is running
+    static void Preempt();
+
+#if CORTEX_WORKER_ACCOUNTING
+public:
+    //! Gets the CPU time used by the worker so far
+    const CortexWorkerCpuStats& CpuStats() const { return cpu; }
+#endif
+
+#if CORTEX_WORKER_STACK_STATS
+public:
+    //! Returns the highest stack usage of the worker so far, found by scanning for the unused fill pattern
+    size_t StackPeak() const;
+    //! Returns the table of stack usage statistics, entries without an entry point are unused
+    static const CortexWorkerStackStats* StackStats(size_t& count);
+    //! Dumps the stack usage of all worker entry points to the debug output
+    static void DumpStackStats();
+#endif
 };
 
 }
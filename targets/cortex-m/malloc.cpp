@@ -9,6 +9,38 @@
  *
  * Also provides malloc_once() for zero-overhead allocations of memory that will be never freed and
  * mtrim() for trimming overallocated memory in-place.
+ *
+ * By default, free blocks are kept in a single address-ordered chain which is searched first-fit.
+ * Defining MALLOC_SEGREGATED switches to exact-size bins for small blocks plus a list of large
+ * blocks, making most allocations O(1). It implies MALLOC_BOUNDARY_TAGS, without them free()
+ * would have to search all the bins for the neighbours of the block.
+ *
+ * Defining MALLOC_BOUNDARY_TAGS marks allocated blocks in their headers and stores the size
+ * of each free block in its last word as well, so free() can find and merge both neighbours
+ * in constant time and push the merged block to the head of its list (LIFO), making free()
+ * O(1). The lists are then no longer address-ordered, first-fit takes the most recently freed
+ * block that fits instead of the lowest one, which can fragment long-running heaps more.
+ * Only next-fit, whose rover is an address, keeps the chain address-ordered and walks it.
+ *
+ * Defining MALLOC_ARENA allows workers to attach a bump allocation arena, from which all
+ * allocations made by the worker are served without taking the heap critical section.
+ *
+ * MALLOC_POLICY selects how the free block to allocate from is chosen, see malloc_internal.h.
+ * Best-fit and good-fit searches keep fragmentation of long-running heaps lower than first-fit,
+ * next-fit spreads allocations across the heap instead of crowding its low end.
+ *
+ * Defining MALLOC_STATS enables collection of additional statistics, see malloc_internal.h
+ *
+ * Defining MALLOC_TRACE records all heap operations into a ring buffer, which can be streamed
+ * over ITM or drained using malloc_trace_write() and analysed using tools/malloc_replay.
+ *
+ * Defining MALLOC_REGIONS allows additional heaps to be placed in other RAM banks using
+ * MALLOC_REGION(), malloc() uses them when the primary heap is exhausted and malloc_class()
+ * or malloc_region() can be used to allocate from a specific kind of memory.
+ *
+ * memalign(), aligned_alloc() and posix_memalign() return the slack in front of the aligned
+ * block to the free lists, the aligned pointer is preceded by a pseudo-header leading free()
+ * to the real block header.
  */
 
 #include <base/base.h>
@@ -17,6 +49,13 @@
 
 #include <malloc_internal.h>
 
+#include <errno.h>
+
+#if MALLOC_TRACE
+#include <kernel/kernel.h>
+#include <unistd.h>
+#endif
+
 #define DIAG_ALLOC      1
 #define DIAG_HEAP       2
 #define DIAG_FREECHAIN  4
@@ -34,30 +73,135 @@
 #endif
 
 static void* _malloc_impl(size_t size, bool clear);
+static void* heap_alloc(__malloc_heap& heap, size_t size, bool clear);
+static void* _memalign_impl(size_t align, size_t size);
+static void _free_impl(void* ptr);
+
+#if MALLOC_TRACE
+
+static_assert(!(MALLOC_TRACE_RECORDS & (MALLOC_TRACE_RECORDS - 1)), "trace ring size must be a power of two");
+
+__malloc_trace_ring __malloc_trace;
+
+//! Appends a record to the trace ring, overwriting the oldest one if it is full
+static void trace_record(uint32_t op, void* ptr, void* old, size_t size, void* caller)
+{
+    if (op == MALLOC_TRACE_FREE && !ptr)
+    {
+        return;
+    }
+
+    PLATFORM_CRITICAL_SECTION();
+
+    auto& t = __malloc_trace;
+    auto& rec = t.records[t.head++ % MALLOC_TRACE_RECORDS];
+    rec.time = MONO_CLOCKS;
+    rec.caller = (uintptr_t)caller;
+    rec.opSize = op << 28 | (size & 0x0FFFFFFF);
+    rec.ptr = (uintptr_t)ptr;
+    rec.old = (uintptr_t)old;
+    if (t.head - t.tail > MALLOC_TRACE_RECORDS)
+    {
+        t.tail++;
+        t.overruns++;
+    }
+
+#ifdef MALLOC_TRACE_ITM_CHANNEL
+    auto words = (const uint32_t*)&rec;
+    for (unsigned i = 0; i < sizeof(rec) / 4; i++)
+    {
+        PLATFORM_DBG_WORD(MALLOC_TRACE_ITM_CHANNEL, words[i]);
+    }
+#endif
+}
+
+int malloc_trace_write(int fd)
+{
+    int n = 0;
+    for (;;)
+    {
+        __malloc_trace_record buf[8];
+        unsigned cnt = 0;
+        {
+            PLATFORM_CRITICAL_SECTION();
+            auto& t = __malloc_trace;
+            while (cnt < sizeof(buf) / sizeof(buf[0]) && t.tail != t.head)
+            {
+                buf[cnt++] = t.records[t.tail++ % MALLOC_TRACE_RECORDS];
+            }
+        }
+
+        if (!cnt)
+        {
+            return n;
+        }
+        if (write(fd, buf, cnt * sizeof(buf[0])) < 0)
+        {
+            return -1;
+        }
+        n += cnt;
+    }
+}
+
+#define MALLOC_TRACE_OP(op, ptr, old, size)   trace_record(MALLOC_TRACE_ ## op, ptr, old, size, __lr)
+#else
+#define MALLOC_TRACE_OP(...)
+#endif
 
 OPTIMIZE void* calloc(size_t size, size_t count)
 {
-    return _malloc_impl(size * count, true);
+    void* res = _malloc_impl(size * count, true);
+    MALLOC_TRACE_OP(CALLOC, res, NULL, size * count);
+    return res;
 }
 
 typedef __malloc_free_list free_list;
 
 INIT_PRIORITY(-10000) __malloc_heap __heap;  // initialize as early as possible
 
-void* _malloc_r(_reent* _, size_t size) { return _malloc_impl(size, false); }
-void _free_r(_reent* _, void* ptr) { free(ptr); }
+#if MALLOC_REGIONS
 
-#if (MALLOC_DIAG) & DIAG_FREECHAIN
-void dump_free_chain()
+// table of all heap regions, the primary heap is always the first one
+__attribute__((used, section(".rospec.malloc.heap"))) static __malloc_heap* const __heaps_start[] = {};
+__attribute__((used, section(".rospec.malloc.heap.0"))) static __malloc_heap* const __heaps_primary = &__heap;
+__attribute__((used, section(".rospec.malloc.heap1"))) static __malloc_heap* const __heaps_end[] = {};
+
+#endif
+
+//! Returns the heap region containing the specified block
+static __malloc_heap& heap_of(void* blk)
 {
-    DBGC("malloc", "FREECHAIN(%4d):", __heap.fragments);
-    for (free_list* p = __heap.free; p; p = p->next)
-        _DBG(" %p+%d=%p", p, p->size, (size_t)p + p->size);
-    _DBG(" (%p+%d=%p)\n", __heap.top, (size_t)__heap.limit - (size_t)__heap.top, __heap.limit);
+#if MALLOC_REGIONS
+    for (auto pp = __heaps_start + 1; pp < __heaps_end; pp++)
+    {
+        if ((*pp)->Contains(blk))
+        {
+            return **pp;
+        }
+    }
+#endif
+    return __heap;
 }
+
+//! Returns the first heap region matching the predicate, starting with the primary heap
+template<typename Predicate> static __malloc_heap* heap_find(Predicate pred)
+{
+#if MALLOC_REGIONS
+    for (auto pp = __heaps_start; pp < __heaps_end; pp++)
+    {
+        if (pred(**pp))
+        {
+            return *pp;
+        }
+    }
+    return NULL;
 #else
-#define dump_free_chain()
+    return pred(__heap) ? &__heap : NULL;
 #endif
+}
+
+void* _malloc_r(_reent* _, size_t size) { return malloc(size); }
+void _free_r(_reent* _, void* ptr) { free(ptr); }
 
 #define BLOCK_ALIGNMENT 16
 #define HEADER_SIZE     (sizeof(size_t) + ALLOC_TRACE_OVERHEAD)
@@ -66,32 +210,472 @@ void dump_free_chain()
 #define BLOCK_ADDR(ptr)	((char*)(ptr) - HEADER_SIZE)
 #define MEM_SIZE(ptr)   (*(size_t*)BLOCK_ADDR(ptr))
 
-void* mtrim(void* ptr, size_t size)
+#define BLOCK_SIZE(hdr) ((hdr) & ~(BLOCK_ALIGNMENT - 1))
+#define ALLOC_SIZE(ptr) BLOCK_SIZE(MEM_SIZE(ptr))
+
+#if MALLOC_BOUNDARY_TAGS
+#define BLOCK_USED      1   // header flag of allocated blocks, free block headers contain only the size
+#define BLOCK_PREV_FREE 2   // header flag of allocated blocks immediately following a free block
+#define BLOCK_FOOTER(blk)   (((size_t*)((uint8_t*)(blk) + (blk)->size))[-1])
+#define FOOTER_SIZE     sizeof(size_t)
+#else
+#define BLOCK_USED      0
+#define FOOTER_SIZE     0
+#endif
+
+#if MALLOC_ARENA
+#define BLOCK_ARENA     8   // header flag of blocks allocated from an arena
+#endif
+
+#define BLOCK_OFFSET    4   // flag of the pseudo-header in front of an aligned pointer, the size is the distance from the real block
+#define OFFSET_SIZE     REQUIRED_BLOCK(sizeof(size_t))  // room for both the real header and the pseudo-header
+#define NATURAL_ALIGNMENT   ((HEADER_SIZE | BLOCK_ALIGNMENT) & -(HEADER_SIZE | BLOCK_ALIGNMENT))   // alignment of all pointers returned by malloc()
+
+//! Returns the pointer to the real block of an aligned allocation, other pointers are returned unchanged
+static void* unalign(void* ptr)
+{
+    size_t hdr = MEM_SIZE(ptr);
+    return hdr & BLOCK_OFFSET ? (uint8_t*)ptr - BLOCK_SIZE(hdr) + HEADER_SIZE : ptr;
+}
+
+// free blocks are kept in doubly-linked lists instead of the address-ordered chain,
+// MALLOC_SEGREGATED implies MALLOC_BOUNDARY_TAGS (see malloc_internal.h)
+#define INDEXED_CHAIN   MALLOC_BOUNDARY_TAGS
+
+//! Selects the free block to allocate from according to MALLOC_POLICY, returns the link pointing to it
+static free_list** chain_select(__malloc_heap& heap, free_list** pp, size_t size)
+{
+    free_list** best = NULL;
+#if MALLOC_POLICY == MALLOC_POLICY_GOOD
+    unsigned candidates = 0;
+#endif
+
+    for (; *pp; pp = &(*pp)->next)
+    {
+        free_list* p = *pp;
+        if (p->size != size && p->size < size + SMALLEST_BLOCK)
+        {
+            // neither an exact match nor a block big enough to slice a part of
+            continue;
+        }
+
+#if MALLOC_POLICY == MALLOC_POLICY_NEXT
+        if ((void*)p < heap.rover)
+        {
+            // blocks below the rover are used only after wrapping around
+            if (!best)
+            {
+                best = pp;
+            }
+            continue;
+        }
+        return pp;
+#elif MALLOC_POLICY == MALLOC_POLICY_FIRST
+        return pp;
+#else
+        if (p->size == size)
+        {
+            // cannot do any better than an exact match
+            return pp;
+        }
+        if (!best || p->size < (*best)->size)
+        {
+            best = pp;
+        }
+#if MALLOC_POLICY == MALLOC_POLICY_GOOD
+        if (++candidates == MALLOC_GOOD_FIT_CANDIDATES)
+        {
+            break;
+        }
+#endif
+#endif
+    }
+
+    return best;
+}
+
+#if INDEXED_CHAIN
+
+static_assert(sizeof(free_list) + FOOTER_SIZE <= SMALLEST_BLOCK, "free block does not fit in the smallest block");
+
+#if MALLOC_SEGREGATED
+#define SMALL_LIMIT     (MALLOC_SMALL_BINS * BLOCK_ALIGNMENT)
+#define SMALL_BIN(size) ((size) / BLOCK_ALIGNMENT - 1)
+#endif
+
+//! Returns the head of the list holding free blocks of the specified size
+static free_list** chain_head(__malloc_heap& heap, size_t size)
+{
+#if MALLOC_SEGREGATED
+    return size <= SMALL_LIMIT ? &heap.small[SMALL_BIN(size)] : &heap.large;
+#else
+    return &heap.free;
+#endif
+}
+
+//! Links a free block into the list matching its size
+static void chain_link(__malloc_heap& heap, free_list* blk)
+{
+    free_list** pp = chain_head(heap, blk->size);
+    free_list* prev = NULL;
+#if MALLOC_SEGREGATED
+    if (blk->size <= SMALL_LIMIT)
+    {
+        heap.smallMask |= BIT(SMALL_BIN(blk->size));
+    }
+#elif MALLOC_POLICY == MALLOC_POLICY_NEXT
+    // the rover of next-fit is an address, keep the chain address-ordered
+    while (*pp && *pp < blk)
+    {
+        prev = *pp;
+        pp = &prev->next;
+    }
+#endif
+    blk->prev = prev;
+    blk->next = *pp;
+    if (blk->next)
+    {
+        blk->next->prev = blk;
+    }
+    *pp = blk;
+}
+
+//! Unlinks a free block from its list
+static free_list* chain_unlink(__malloc_heap& heap, free_list* blk)
+{
+    if (blk->next)
+    {
+        blk->next->prev = blk->prev;
+    }
+    if (blk->prev)
+    {
+        blk->prev->next = blk->next;
+    }
+    else
+    {
+        free_list** head = chain_head(heap, blk->size);
+        *head = blk->next;
+#if MALLOC_SEGREGATED
+        if (!*head && blk->size <= SMALL_LIMIT)
+        {
+            heap.smallMask &= ~BIT(SMALL_BIN(blk->size));
+        }
+#endif
+    }
+    return blk;
+}
+
+//! Turns the memory at blk into a free block of the specified size and links it
+static void chain_put(__malloc_heap& heap, free_list* blk, size_t size)
+{
+    blk->size = size;
+    BLOCK_FOOTER(blk) = size;
+    chain_link(heap, blk);
+}
+
+//! Unlinks and returns a free block that either matches the size exactly or can be split
+static free_list* chain_take(__malloc_heap& heap, size_t size)
+{
+    free_list** head = chain_head(heap, size);
+#if MALLOC_SEGREGATED
+    if (size <= SMALL_LIMIT)
+    {
+        unsigned bin = SMALL_BIN(size);
+        if (GETBIT(heap.smallMask, bin))
+        {
+            return chain_unlink(heap, *head);
+        }
+
+        // the smallest non-empty bin that leaves a usable remainder
+        bin = SMALL_BIN(size + SMALLEST_BLOCK);
+        if (bin < MALLOC_SMALL_BINS)
+        {
+            if (uint32_t mask = heap.smallMask & (~0u << bin))
+            {
+                return chain_unlink(heap, heap.small[__builtin_ctz(mask)]);
+            }
+        }
+
+        head = &heap.large;
+    }
+#endif
+
+    free_list** pp = chain_select(heap, head, size);
+    return pp ? chain_unlink(heap, *pp) : NULL;
+}
+
+//! Returns the free block starting at the specified address, if any
+static free_list* chain_at(__malloc_heap& heap, void* addr)
+{
+    return addr < heap.top && !(*(size_t*)addr & BLOCK_USED) ? (free_list*)addr : NULL;
+}
+
+//! Updates the BLOCK_PREV_FREE flag of the block starting at the specified address, if any
+static void set_prev_free(__malloc_heap& heap, void* addr, bool prevFree)
+{
+    if (addr < heap.top)
+    {
+        if (prevFree)
+        {
+            *(size_t*)addr |= BLOCK_PREV_FREE;
+        }
+        else
+        {
+            *(size_t*)addr &= ~BLOCK_PREV_FREE;
+        }
+    }
+}
+
+#endif
+
+//! Returns the first free block matching the predicate, walking all free lists
+template<typename Predicate> static free_list* chain_find(__malloc_heap& heap, Predicate pred)
+{
+#if MALLOC_SEGREGATED
+    for (uint32_t mask = heap.smallMask; mask; mask &= mask - 1)
+    {
+        for (free_list* p = heap.small[__builtin_ctz(mask)]; p; p = p->next)
+        {
+            if (pred(p))
+            {
+                return p;
+            }
+        }
+    }
+
+    for (free_list* p = heap.large; p; p = p->next)
+#else
+    for (free_list* p = heap.free; p; p = p->next)
+#endif
+    {
+        if (pred(p))
+        {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+#if (MALLOC_DIAG) & DIAG_FREECHAIN
+void dump_free_chain(__malloc_heap& heap)
+{
+    DBGC("malloc", "FREECHAIN(%4d):", heap.fragments);
+#if MALLOC_SEGREGATED
+    for (unsigned bin = 0; bin < MALLOC_SMALL_BINS; bin++)
+        for (free_list* p = heap.small[bin]; p; p = p->next)
+            _DBG(" %p+%d=%p", p, p->size, (size_t)p + p->size);
+    _DBG(" |");
+    for (free_list* p = heap.large; p; p = p->next)
+#else
+    for (free_list* p = heap.free; p; p = p->next)
+#endif
+        _DBG(" %p+%d=%p", p, p->size, (size_t)p + p->size);
+    _DBG(" (%p+%d=%p)\n", heap.top, (size_t)heap.limit - (size_t)heap.top, heap.limit);
+}
+#else
+#define dump_free_chain(heap)
+#endif
+
+#if MALLOC_STATS
+
+#ifndef MALLOC_CYCLE_COUNT
+#ifdef PLATFORM_CYCLE_COUNT
+#define MALLOC_CYCLE_COUNT  PLATFORM_CYCLE_COUNT
+#else
+#define MALLOC_CYCLE_COUNT  (DWT->CYCCNT)
+#endif
+#endif
+
+//! Records the worst-case number of cycles spent in the scope where it is defined
+struct stats_timer
+{
+    uint32_t& worst;
+    uint32_t start = MALLOC_CYCLE_COUNT;
+
+    ~stats_timer()
+    {
+        uint32_t t = MALLOC_CYCLE_COUNT - start;
+        if (t > worst)
+        {
+            worst = t;
+        }
+    }
+};
+
+#define STATS_TIMER(field)  stats_timer __timer { heap.stats.field }
+
+static unsigned stats_class(size_t size)
+{
+    unsigned cls = 31 - __builtin_clz(size / BLOCK_ALIGNMENT);
+    return cls < MALLOC_STATS_CLASSES ? cls : MALLOC_STATS_CLASSES - 1;
+}
+
+//! Updates the peak committed memory after the break has moved up
+static void stats_peak(__malloc_heap& heap)
+{
+    if (heap.Committed() > heap.stats.peakCommitted)
+    {
+        heap.stats.peakCommitted = heap.Committed();
+    }
+}
+
+__malloc_free_stats malloc_free_stats(__malloc_heap& heap)
+{
+    PLATFORM_CRITICAL_SECTION();
+
+    __malloc_free_stats res = {};
+    res.largest = heap.ContiguousFree();
+    chain_find(heap, [&](free_list* p)
+    {
+        res.histogram[stats_class(p->size)]++;
+        if (p->size > res.largest)
+        {
+            res.largest = p->size;
+        }
+        return false;
+    });
+    return res;
+}
+
+void malloc_stats_dump()
+{
+    heap_find([](__malloc_heap& heap)
+    {
+        auto fs = malloc_free_stats(heap);
+        auto st = heap.stats;
+#if MALLOC_REGIONS
+        MYDBG("heap %p-%p, class %X", heap.Start(), heap.End(), heap.flags);
+#endif
+        MYDBG("used %d/%d, committed %d (peak %d), fragments %d, once %d", heap.Used(), heap.Total(), heap.Committed(), st.peakCommitted, heap.Fragments(), heap.Once());
+        MYDBG("largest free %d, failures %d, worst malloc %d cycles, worst free %d cycles", fs.largest, st.failures, st.mallocCycles, st.freeCycles);
+        for (unsigned i = 0; i < MALLOC_STATS_CLASSES; i++)
+        {
+            MYDBG("%6d+: allocs %8d, free %6d", BLOCK_ALIGNMENT << i, st.allocs[i], fs.histogram[i]);
+        }
+        return false;
+    });
+}
+
+void malloc_stats_reset()
+{
+    PLATFORM_CRITICAL_SECTION();
+
+    heap_find([](__malloc_heap& heap)
+    {
+        heap.stats = {};
+        heap.stats.peakCommitted = heap.Committed();
+        return false;
+    });
+}
+
+#else
+#define STATS_TIMER(field)
+#define stats_peak(heap)
+#endif
+
+//! Writes the block header and returns the pointer to be handed out
+static void* block_init(void* blk, size_t hdr, bool clear)
+{
+    // first word is size, the rest is to be returned
+    *(size_t*)blk = hdr;
+    if (clear)
+    {
+        size_t size = BLOCK_SIZE(hdr);
+        for (size_t i = sizeof(size_t); i < size; i += sizeof(size_t))
+        {
+            *(size_t*)((intptr_t)blk + i) = 0;
+        }
+    }
+
+    void* res = (char*)blk + sizeof(size_t) + ALLOC_TRACE_OVERHEAD;
+    __trace_alloc(res, BLOCK_SIZE(hdr) - ALLOC_TRACE_OVERHEAD);
+    return res;
+}
+
+#if MALLOC_ARENA
+
+__malloc_arena* __malloc_current_arena;
+
+//! Returns the arena to be used in the current context, arenas are never used from interrupt handlers
+static __malloc_arena* arena_current()
+{
+    return __malloc_current_arena && !__get_IPSR() ? __malloc_current_arena : NULL;
+}
+
+//! Resizes a block allocated from an arena, it can be done in place only if it is the last block allocated from the current arena
+static void* arena_realloc(void* ptr, size_t size)
+{
+    size_t curSize = ALLOC_SIZE(ptr);
+    size_t newSize = REQUIRED_BLOCK(size);
+    uint8_t* blk = (uint8_t*)BLOCK_ADDR(ptr);
+    __malloc_arena* a = arena_current();
+    if (a && blk + curSize == a->ptr && blk + newSize <= a->end)
+    {
+        MYDIAG(DIAG_ALLOC, "~[%p] %p %d>%d (arena)", __lr, ptr, curSize, newSize);
+        a->ptr = blk + newSize;
+        MEM_SIZE(ptr) += newSize - curSize;
+        return ptr;
+    }
+
+    if (newSize <= curSize)
+    {
+        // cannot shrink a block in the middle of an arena
+        return ptr;
+    }
+
+    // the original block is released together with the whole arena
+    void* pNew = _malloc_impl(size, false);
+    if (pNew)
+    {
+        memcpy(pNew, ptr, curSize - HEADER_SIZE);
+    }
+    return pNew;
+}
+
+#endif
+
+static void* _mtrim_impl(void* ptr, size_t size)
 {
     if (!size)
     {
         return ptr;
     }
 
+#if MALLOC_ARENA
+    if (MEM_SIZE(ptr) & BLOCK_ARENA)
+    {
+        return arena_realloc(ptr, size);
+    }
+#endif
+
+    if (MEM_SIZE(ptr) & BLOCK_OFFSET)
+    {
+        // trim the real block, keeping the data at the aligned pointer
+        size_t offset = ALLOC_SIZE(ptr);
+        _mtrim_impl((uint8_t*)ptr - offset + HEADER_SIZE, size + offset - HEADER_SIZE);
+        return ptr;
+    }
+
     PLATFORM_CRITICAL_SECTION();
 
     size = REQUIRED_BLOCK(size);
-    size_t cur = MEM_SIZE(ptr);
+    size_t cur = ALLOC_SIZE(ptr);
     if (cur >= size + SMALLEST_BLOCK)
     {
         // there is space to be trimmed - we divide the allocated block in two and free the second part
-        MEM_SIZE(ptr) = size;	// new size of the first block
+        MEM_SIZE(ptr) += size - cur;	// new size of the first block, keeping the flags
         void* p2 = (uint8_t*)ptr + size;
-        MEM_SIZE(p2) = cur - size; 	// remainder to be freed
+        MEM_SIZE(p2) = (cur - size) | BLOCK_USED; 	// remainder to be freed
         MYDIAG(DIAG_ALLOC, "-[%p] %p-%d=%d +%p=%d", __lr, BLOCK_ADDR(ptr), cur - size, size, BLOCK_ADDR(p2), cur - size);
         __trace_alloc(p2, cur - size);  // must do this to avoid free before alloc
-        free(p2);
+        _free_impl(p2);
     }
 
     return ptr;
 }
 
-void* realloc(void* ptr, size_t size)
+static void* _realloc_impl(void* ptr, size_t size)
 {
     PLATFORM_CRITICAL_SECTION();
 
@@ -100,14 +684,39 @@ void* realloc(void* ptr, size_t size)
         return _malloc_impl(size, false);
     }
 
-    size_t curSize = MEM_SIZE(ptr);
-    ASSERT(curSize <= __heap.Total());  // catch corrupted memory ASAP
+#if MALLOC_ARENA
+    if (MEM_SIZE(ptr) & BLOCK_ARENA)
+    {
+        return arena_realloc(ptr, size);
+    }
+#endif
+
+    if (MEM_SIZE(ptr) & BLOCK_OFFSET)
+    {
+        // realloc() does not have to preserve the alignment, so an aligned block is grown by moving it
+        size_t avail = ALLOC_SIZE(unalign(ptr)) - ALLOC_SIZE(ptr);
+        if (size <= avail)
+        {
+            return _mtrim_impl(ptr, size);
+        }
+        void* pNew = _malloc_impl(size, false);
+        if (pNew)
+        {
+            memcpy(pNew, ptr, avail);
+            _free_impl(ptr);
+        }
+        return pNew;
+    }
+
+    __malloc_heap& heap = heap_of(BLOCK_ADDR(ptr));
+    size_t curSize = ALLOC_SIZE(ptr);
+    ASSERT(curSize <= heap.Total());  // catch corrupted memory ASAP
     size_t increment = REQUIRED_BLOCK(size) - curSize;
     if (int(increment) <= -int(SMALLEST_BLOCK))
     {
         // trim the block
         MYDIAG(DIAG_ALLOC, "~[%p] %p %d>%d", __lr, ptr, curSize, curSize + increment);
-        return mtrim(ptr, size);
+        return _mtrim_impl(ptr, size);
     }
     if (int(increment) <= 0)
     {
@@ -118,7 +727,30 @@ void* realloc(void* ptr, size_t size)
 
     // try to find if there is a free block immediately following the current block
     free_list* wantFree = (free_list*)(BLOCK_ADDR(ptr) + curSize);
-    free_list** pp = &__heap.free;
+#if INDEXED_CHAIN
+    free_list* p = chain_at(heap, wantFree);
+    if (p && p->size >= increment)
+    {
+        chain_unlink(heap, p);
+        if (p->size == increment)
+        {
+            MYDIAG(DIAG_ALLOC, "+[%p] %p+%p=%d", __lr, ptr, p, increment);
+            set_prev_free(heap, (uint8_t*)p + increment, false);
+        }
+        else
+        {
+            // return the rest of the free block
+            ASSERT(p->size >= increment + SMALLEST_BLOCK);
+            free_list* rest = (free_list*)((uint8_t*)p + increment);
+            chain_put(heap, rest, p->size - increment);
+            MYDIAG(DIAG_ALLOC, "+[%p] %p+%p<%d +%p=%d", __lr, ptr, p, increment, rest, rest->size);
+        }
+        MEM_SIZE(ptr) += increment;
+        heap.fragments -= increment;
+        return ptr;
+    }
+#else
+    free_list** pp = &heap.free;
     for (free_list* p = *pp; p; pp = &p->next, p = p->next)
     {
         if (p < wantFree)
@@ -147,116 +779,411 @@ void* realloc(void* ptr, size_t size)
             MYDIAG(DIAG_ALLOC, "+[%p] %p+%p<%d +%p=%d", __lr, ptr, p, increment, *pp, (*pp)->size);
         }
         MEM_SIZE(ptr) += increment;
+        heap.fragments -= increment;
         return ptr;
     }
+#endif
+
+    // find the free neighbours of the block
+    uint8_t* blk = (uint8_t*)BLOCK_ADDR(ptr);
+    uint8_t* end = blk + curSize;
+#if INDEXED_CHAIN
+    free_list* next = chain_at(heap, end);
+    free_list* prev = (MEM_SIZE(ptr) & BLOCK_PREV_FREE) ? (free_list*)(blk - ((size_t*)blk)[-1]) : NULL;
+#else
+    free_list** ppPrev = NULL;
+    for (pp = &heap.free; *pp && (uint8_t*)*pp < blk; pp = &(*pp)->next)
+    {
+        ppPrev = pp;
+    }
+    free_list* next = (uint8_t*)*pp == end ? *pp : NULL;
+    free_list* prev = ppPrev && (uint8_t*)*ppPrev + (*ppPrev)->size == blk ? *ppPrev : NULL;
+#endif
+
+    size_t need = curSize + increment;
+    size_t avail = curSize + (next ? next->size : 0);
+    bool atTop = end + (next ? next->size : 0) == heap.top;
+    size_t brk = atTop ? (uint8_t*)heap.limit - (uint8_t*)heap.top : 0;
+    bool grow = atTop && avail + brk >= need;
+    bool move = !grow && prev && prev->size + avail + brk >= need;
+
+    if (grow || move)
+    {
+        // the block can grow by merging with the free neighbours and/or moving the break
+#if INDEXED_CHAIN
+        if (next)
+        {
+            chain_unlink(heap, next);
+        }
+        if (move)
+        {
+            chain_unlink(heap, prev);
+        }
+#else
+        if (next)
+        {
+            *pp = next->next;
+        }
+        if (move)
+        {
+            *ppPrev = prev->next;
+        }
+#endif
+        heap.fragments -= avail - curSize;
+
+        if (move)
+        {
+            // move the data down to the preceding free block
+            heap.fragments -= prev->size;
+            avail += prev->size;
+            MYDIAG(DIAG_ALLOC, "~[%p] %p<%p %d>%d", __lr, ptr, prev, curSize, avail);
+            __trace_free(ptr);
+            memmove((uint8_t*)prev + HEADER_SIZE, ptr, curSize - HEADER_SIZE);
+            blk = (uint8_t*)prev;
+            ptr = block_init(blk, avail | BLOCK_USED, false);
+        }
+        else
+        {
+            MEM_SIZE(ptr) += avail - curSize;
+        }
+
+        if (atTop && avail < need)
+        {
+            // extend into the break
+            MYDIAG(DIAG_HEAP, "HEAP: %p+%d=%p", heap.top, need - avail, blk + need);
+            heap.top = blk + need;
+            stats_peak(heap);
+            MEM_SIZE(ptr) += need - avail;
+            return ptr;
+        }
+
+#if MALLOC_BOUNDARY_TAGS
+        set_prev_free(heap, blk + avail, false);
+#endif
+        // return the unused part, if any
+        return _mtrim_impl(ptr, size);
+    }
 
     // fallback: allocate a whole new block
+#if MALLOC_REGIONS
+    // preferably in the same region
+    void* pNew = heap_alloc(heap, REQUIRED_BLOCK(size), false);
+    if (!pNew)
+    {
+        pNew = _malloc_impl(size, false);
+    }
+#else
     void* pNew = _malloc_impl(size, false);
-    MYDIAG(DIAG_ALLOC, "~[%p] %p>%p %d>%d", __lr, ptr, pNew, curSize, MEM_SIZE(pNew));
+#endif
+    if (!pNew)
+    {
+        // the original block stays valid
+        return NULL;
+    }
+    MYDIAG(DIAG_ALLOC, "~[%p] %p>%p %d>%d", __lr, ptr, pNew, curSize, ALLOC_SIZE(pNew));
     memcpy(pNew, ptr, curSize - HEADER_SIZE);
-    free(ptr);
+    _free_impl(ptr);
     return pNew;
 }
 
+// public entry points record the operations, internal calls must not be traced
+void* mtrim(void* ptr, size_t size)
+{
+    void* res = _mtrim_impl(ptr, size);
+    MALLOC_TRACE_OP(TRIM, res, ptr, size);
+    return res;
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    void* res = _realloc_impl(ptr, size);
+    MALLOC_TRACE_OP(REALLOC, res, ptr, size);
+    return res;
+}
+
+void free(void* ptr)
+{
+    MALLOC_TRACE_OP(FREE, ptr, NULL, 0);
+    _free_impl(ptr);
+}
+
 OPTIMIZE void* malloc(size_t size)
 {
-    return _malloc_impl(size, false);
+    void* res = _malloc_impl(size, false);
+    MALLOC_TRACE_OP(MALLOC, res, NULL, size);
+    return res;
+}
+
+void* memalign(size_t align, size_t size)
+{
+    void* res = _memalign_impl(align, size);
+    MALLOC_TRACE_OP(MEMALIGN, res, (void*)align, size);
+    return res;
+}
+
+void* aligned_alloc(size_t align, size_t size)
+{
+    void* res = _memalign_impl(align, size);
+    MALLOC_TRACE_OP(MEMALIGN, res, (void*)align, size);
+    return res;
+}
+
+int posix_memalign(void** memptr, size_t align, size_t size)
+{
+    if ((align & (align - 1)) || align % sizeof(void*))
+    {
+        return EINVAL;
+    }
+
+    void* res = _memalign_impl(align, size);
+    MALLOC_TRACE_OP(MEMALIGN, res, (void*)align, size);
+    if (!res && size)
+    {
+        return ENOMEM;
+    }
+    *memptr = res;
+    return 0;
+}
+
+void* _memalign_r(_reent* _, size_t align, size_t size) { return memalign(align, size); }
+
+#if MALLOC_REGIONS
+
+void* malloc_region(__malloc_heap& heap, size_t size)
+{
+    if (!size)
+        return NULL;
+
+    void* res = heap_alloc(heap, REQUIRED_BLOCK(size), false);
+    if (!res)
+    {
+        MYDBG("failed, not enough memory left in %p-%p", heap.Start(), heap.End());
+    }
+    MALLOC_TRACE_OP(MALLOC, res, NULL, size);
+    return res;
+}
+
+void* malloc_class(uint32_t cls, size_t size)
+{
+    if (!size)
+        return NULL;
+
+    void* res = NULL;
+    size_t block = REQUIRED_BLOCK(size);
+    if (!heap_find([&](__malloc_heap& heap) { return (heap.flags & cls) == cls && (res = heap_alloc(heap, block, false)); }))
+    {
+        // no region of the requested class has enough space, use any memory
+        res = _malloc_impl(size, false);
+    }
+    MALLOC_TRACE_OP(MALLOC, res, NULL, size);
+    return res;
 }
 
+#endif
+
 void* _malloc_impl(size_t size, bool clear)
 {
     if (!size)
         return NULL;
 
+    size = REQUIRED_BLOCK(size);
+
+#if MALLOC_ARENA
+    if (__malloc_arena* a = arena_current())
+    {
+        // arenas are private to a worker, no need for a critical section
+        if (size_t(a->end - a->ptr) >= size)
+        {
+            void* res = a->ptr;
+            a->ptr += size;
+            MYDIAG(DIAG_ALLOC, "+[%p] %p=%d (arena)", __lr, res, size);
+            return block_init(res, size | BLOCK_USED | BLOCK_ARENA, clear);
+        }
+    }
+#endif
+
+    void* res = NULL;
+    if (!heap_find([&](__malloc_heap& heap) { return !!(res = heap_alloc(heap, size, clear)); }))
+    {
+        MYDBG("failed, not enough memory left");
+    }
+    return res;
+}
+
+void* heap_alloc(__malloc_heap& heap, size_t size, bool clear)
+{
     PLATFORM_CRITICAL_SECTION();
+    STATS_TIMER(mallocCycles);
 
-    size = REQUIRED_BLOCK(size);
-    free_list** pp = &__heap.free;
+#if INDEXED_CHAIN
     void* res = NULL;
 
-    for (free_list* p = *pp; p; pp = &p->next, p = p->next)
+    if (free_list* p = chain_take(heap, size))
     {
+        if (p->size == size)
+        {
+            MYDIAG(DIAG_ALLOC, "+[%p] %p=%d", __lr, p, size);
+            set_prev_free(heap, (uint8_t*)p + size, false);
+        }
+        else
+        {
+            // return the rest of the block to the appropriate list
+            free_list* rest = (free_list*)((uint8_t*)p + size);
+            chain_put(heap, rest, p->size - size);
+            MYDIAG(DIAG_ALLOC, "+[%p] %p<%d +%p=%d", __lr, p, size, rest, rest->size);
+        }
+        res = p;
+    }
+#else
+    void* res = NULL;
+
+    if (free_list** pp = chain_select(heap, &heap.free, size))
+    {
+        free_list* p = *pp;
         if (p->size == size)
         {
             // a free block matches our requirement perfectly
             *pp = p->next;
-            res = p;
             MYDIAG(DIAG_ALLOC, "+[%p] %p=%d", __lr, p, size);
-            break;
         }
-
-        if (p->size >= size + SMALLEST_BLOCK)
+        else
         {
             // a big enough block to slice a part of
-            res = p;
             *pp = (free_list*)((uint8_t*)p + size);
             (*pp)->next = p->next;
             (*pp)->size = p->size - size;
             MYDIAG(DIAG_ALLOC, "+[%p] %p<%d +%p=%d", __lr, p, size, *pp, (*pp)->size);
-            break;
         }
+        res = p;
     }
+#endif
 
     if (!res)
     {
         // not enough space, let's grow the heap
-        void* brkptr = (uint8_t*)__heap.top + size;
-        if (brkptr > __heap.limit)
+        void* brkptr = (uint8_t*)heap.top + size;
+        if (brkptr > heap.limit)
         {
-            MYDBG("failed, not enough memory left");
+#if MALLOC_STATS
+            heap.stats.failures++;
+#endif
             return NULL;
         }
         else
         {
-            MYDIAG(DIAG_ALLOC, "+[%p] %p+%d=%p", __lr, __heap.top, size, brkptr);
-            MYDIAG(DIAG_HEAP, "HEAP: %p+%d=%p", __heap.top, size, brkptr);
+            MYDIAG(DIAG_ALLOC, "+[%p] %p+%d=%p", __lr, heap.top, size, brkptr);
+            MYDIAG(DIAG_HEAP, "HEAP: %p+%d=%p", heap.top, size, brkptr);
         }
 
-        res = __heap.top;
-        __heap.top = brkptr;
+        res = heap.top;
+        heap.top = brkptr;
+        stats_peak(heap);
     }
     else
     {
-        __heap.fragments -= size;
+        heap.fragments -= size;
     }
 
-    dump_free_chain();
+#if MALLOC_POLICY == MALLOC_POLICY_NEXT
+    // the next search continues after the block just allocated
+    heap.rover = (uint8_t*)res + size;
+#endif
 
-    // res is actually start of block, first word is size, the rest is to be returned
-    *(size_t*)res = size;
-    if (clear)
+    dump_free_chain(heap);
+
+#if MALLOC_STATS
+    heap.stats.allocs[stats_class(size)]++;
+#endif
+
+    return block_init(res, size | BLOCK_USED, clear);
+}
+
+void* _memalign_impl(size_t align, size_t size)
+{
+    if (align <= NATURAL_ALIGNMENT)
     {
-        for (size_t i = sizeof(size_t); i < size; i += sizeof(size_t))
-        {
-            *(size_t*)((intptr_t)res + i) = 0;
-        }
+        // any block will do
+        return _malloc_impl(size, false);
     }
 
-    res = (char*)res + sizeof(size_t) + ALLOC_TRACE_OVERHEAD;
-    __trace_alloc(res, size - ALLOC_TRACE_OVERHEAD);
-    return res;
+    if (!size || (align & (align - 1)))
+        return NULL;
+
+    // the aligned pointer is always OFFSET_SIZE bytes from the start of its block
+    if (align < BLOCK_ALIGNMENT)
+        align = BLOCK_ALIGNMENT;
+
+    PLATFORM_CRITICAL_SECTION();
+
+    // arenas are skipped, the slack could not be reused there
+    void* res = NULL;
+    size_t block = REQUIRED_BLOCK(size + align - BLOCK_ALIGNMENT + OFFSET_SIZE - HEADER_SIZE);
+    if (!heap_find([&](__malloc_heap& heap) { return !!(res = heap_alloc(heap, block, false)); }))
+    {
+        MYDBG("failed, not enough memory left");
+        return NULL;
+    }
+
+    if (!((uintptr_t)res & (align - 1)))
+    {
+        // aligned already, just return the excess
+        return _mtrim_impl(res, size);
+    }
+
+    uint8_t* blk = (uint8_t*)BLOCK_ADDR(res);
+    uint8_t* aligned = (uint8_t*)(((uintptr_t)blk + OFFSET_SIZE + align - 1) & ~(align - 1));
+    uint8_t* start = aligned - OFFSET_SIZE;
+    if (start == blk)
+    {
+        __trace_free(res);
+    }
+    else
+    {
+        // split the block and free the leading slack, it is always a multiple of BLOCK_ALIGNMENT
+        size_t hdr = *(size_t*)blk;
+        *(size_t*)start = (blk + BLOCK_SIZE(hdr) - start) | BLOCK_USED;
+        *(size_t*)blk = (start - blk) | (hdr - BLOCK_SIZE(hdr));    // keeping the flags
+        MYDIAG(DIAG_ALLOC, "@[%p] %p-%d %p@%d", __lr, blk, start - blk, aligned, align);
+        _free_impl(res);
+    }
+
+    _mtrim_impl(start + HEADER_SIZE, size + OFFSET_SIZE - HEADER_SIZE);
+    MEM_SIZE(aligned) = OFFSET_SIZE | BLOCK_OFFSET;
+    __trace_alloc(aligned, BLOCK_SIZE(*(size_t*)start) - OFFSET_SIZE);
+    return aligned;
 }
 
 int __dbglines;
 
-void* malloc_once(size_t size)
+//! Takes memory from the end of the primary heap, the limit only ever moves down
+static void* once_alloc(size_t align, size_t size, void* caller)
 {
     PLATFORM_CRITICAL_SECTION();
 
-    void* ptr = (uint8_t*)__heap.limit - size;
+    void* ptr = (void*)(((uintptr_t)__heap.limit - size) & ~(align - 1));
     if (ptr < __heap.top)
     {
-        DBGCL("malloc_once", "[%p] %p-%u=%p<%p", __lr, __heap.limit, size, ptr, __heap.top);
+        DBGCL("malloc_once", "[%p] %p-%u=%p<%p", caller, __heap.limit, size, ptr, __heap.top);
         return NULL;
     }
 #if (MALLOC_DIAG) & DIAG_ALLOC
-    DBGCL("malloc_once", "[%p] %p-%u=%p", __lr, __heap.limit, size, ptr);
+    DBGCL("malloc_once", "[%p] %p-%u=%p", caller, __heap.limit, size, ptr);
 #endif
     __heap.limit = ptr;
     return ptr;
 }
 
-void free(void* ptr)
+void* malloc_once(size_t size)
+{
+    return once_alloc(1, size, __lr);
+}
+
+void* malloc_once_aligned(size_t align, size_t size)
+{
+    return once_alloc(align, size, __lr);
+}
+
+void _free_impl(void* ptr)
 {
     if (!ptr)
         return;
@@ -264,14 +1191,68 @@ void free(void* ptr)
     PLATFORM_CRITICAL_SECTION();
 
     __trace_free(ptr);
+    ptr = unalign(ptr);
+
+#if MALLOC_ARENA
+    if (MEM_SIZE(ptr) & BLOCK_ARENA)
+    {
+        // arena blocks are released all at once, only the last one can be returned early
+        __malloc_arena* a = arena_current();
+        uint8_t* blk = (uint8_t*)BLOCK_ADDR(ptr);
+        if (a && blk + ALLOC_SIZE(ptr) == a->ptr)
+        {
+            a->ptr = blk;
+        }
+        return;
+    }
+#endif
 
-    free_list** pp = &__heap.free;
     ptr = BLOCK_ADDR(ptr);
-    size_t size = *(size_t*)ptr;
-    ASSERT(size <= __heap.Total());  // catch corrupted memory ASAP
+    __malloc_heap& heap = heap_of(ptr);
+    STATS_TIMER(freeCycles);
+
+    size_t hdr = *(size_t*)ptr;
+    size_t size = BLOCK_SIZE(hdr);
+    ASSERT(size <= heap.Total());  // catch corrupted memory ASAP
+#if MALLOC_BOUNDARY_TAGS
+    ASSERT(hdr & BLOCK_USED);   // catch double free
+#endif
     void* end = (uint8_t*)ptr + size;
     free_list* cur = (free_list*)ptr;
 
+#if INDEXED_CHAIN
+    cur->size = size;
+    if (free_list* p = chain_at(heap, end))
+    {
+        // the block being freed is immediately before another free block
+        MYDIAG(DIAG_ALLOC, "-[%p] %p+%p=%d+%d", __lr, cur, p, size, p->size);
+        cur->size += chain_unlink(heap, p)->size;
+    }
+    if (hdr & BLOCK_PREV_FREE)
+    {
+        free_list* p = (free_list*)((uint8_t*)ptr - ((size_t*)ptr)[-1]);
+        // the block being freed is immediately after another free block
+        MYDIAG(DIAG_ALLOC, "-[%p] %p+%p=%d+%d", __lr, cur, p, size, p->size);
+        chain_unlink(heap, p)->size += cur->size;
+        cur = p;
+    }
+
+    heap.fragments += size;
+    if ((uint8_t*)cur + cur->size == heap.top)
+    {
+        // let's shrink the heap
+        MYDIAG(DIAG_HEAP, "HEAP: %p-%d=%p", heap.top, cur->size, cur);
+        heap.top = cur;
+        heap.fragments -= cur->size;
+    }
+    else
+    {
+        chain_put(heap, cur, cur->size);
+        set_prev_free(heap, (uint8_t*)cur + cur->size, true);
+    }
+#else
+    free_list** pp = &heap.free;
+
     for (free_list* p = *pp; p && p <= end; pp = &p->next, p = p->next)
     {
         if (p == end)
@@ -309,25 +1290,29 @@ void free(void* ptr)
     cur->size = size;
 
 done:
-    __heap.fragments += size;
-    if ((uint8_t*)cur + cur->size == __heap.top)
+    heap.fragments += size;
+    if ((uint8_t*)cur + cur->size == heap.top)
     {
         // let's shrink the heap
         ASSERT(!cur->next);
-        MYDIAG(DIAG_HEAP, "HEAP: %p-%d=%p", __heap.top, cur->size, cur);
-        __heap.top = cur;
-        __heap.fragments -= cur->size;
+        MYDIAG(DIAG_HEAP, "HEAP: %p-%d=%p", heap.top, cur->size, cur);
+        heap.top = cur;
+        heap.fragments -= cur->size;
         *pp = NULL;
     }
     else
     {
         *pp = cur;
     }
+#endif
 
-    dump_free_chain();
+    dump_free_chain(heap);
 }
 
+#if !MALLOC_HOST
+// MALLOC_HOST is defined when building the allocator natively, e.g. for tools/malloc_replay
 void* operator new(size_t size) __attribute__((leaf, nothrow, alias("malloc")));
 void* operator new[](size_t size) __attribute__((leaf, nothrow, alias("malloc")));
 void operator delete(void* ptr) __attribute__((leaf, nothrow, alias("free")));
 void operator delete[](void* ptr) __attribute__((leaf, nothrow, alias("free")));
+#endif
@@ -14,26 +14,222 @@
 
 #include <ld_symbols.h>
 
+#if MALLOC_SEGREGATED && !defined(MALLOC_BOUNDARY_TAGS)
+//! Segregated bins find the free neighbours of a block using boundary tags, walking all bins would make free() slower than with a single chain
+#define MALLOC_BOUNDARY_TAGS    1
+#endif
+
+#if MALLOC_SEGREGATED && !MALLOC_BOUNDARY_TAGS
+#error MALLOC_SEGREGATED requires MALLOC_BOUNDARY_TAGS
+#endif
+
 struct __malloc_free_list
 {
+    size_t size;    // overlaps the header of an allocated block
     struct __malloc_free_list* next;
-    size_t size;
+#if MALLOC_BOUNDARY_TAGS
+    struct __malloc_free_list* prev;
+#endif
+};
+
+#if MALLOC_SEGREGATED
+
+#ifndef MALLOC_SMALL_BINS
+//! Number of exact-size bins for small free blocks, bin N holds blocks of (N + 1) * 16 bytes
+#define MALLOC_SMALL_BINS   32
+#endif
+
+static_assert(MALLOC_SMALL_BINS <= 32, "small bin occupancy must fit in a 32-bit mask");
+
+#endif
+
+//! Placement policies selectable using MALLOC_POLICY
+//! Without MALLOC_BOUNDARY_TAGS the free chain is address-ordered, with them it is LIFO for all policies
+//! but NEXT, so FIRST and GOOD examine the most recently freed blocks first and exact-size ties go to them
+#define MALLOC_POLICY_FIRST 0   //!< first block that fits
+#define MALLOC_POLICY_BEST  1   //!< smallest block that fits
+#define MALLOC_POLICY_NEXT  2   //!< first block that fits at or above the end of the previous allocation
+#define MALLOC_POLICY_GOOD  3   //!< smallest of the first MALLOC_GOOD_FIT_CANDIDATES blocks that fit
+
+#ifndef MALLOC_POLICY
+#define MALLOC_POLICY       MALLOC_POLICY_FIRST
+#endif
+
+#if MALLOC_POLICY == MALLOC_POLICY_GOOD && !defined(MALLOC_GOOD_FIT_CANDIDATES)
+//! Number of fitting blocks examined by the good-fit policy before settling for the best of them
+#define MALLOC_GOOD_FIT_CANDIDATES  4
+#endif
+
+#if MALLOC_ARENA
+
+//! Bump allocation region, blocks allocated from it are never freed individually
+struct __malloc_arena
+{
+    uint8_t* start;
+    uint8_t* ptr;
+    uint8_t* end;
 };
 
+//! Arena serving allocations made in thread mode, maintained by the worker switching code
+extern __malloc_arena* __malloc_current_arena;
+
+#endif
+
+#if MALLOC_STATS
+
+#ifndef MALLOC_STATS_CLASSES
+//! Number of power-of-two size classes tracked by statistics, class N covers blocks of 16 << N bytes and more
+#define MALLOC_STATS_CLASSES    12
+#endif
+
+struct __malloc_stats
+{
+    size_t peakCommitted;                       //!< highest break reached so far
+    uint32_t allocs[MALLOC_STATS_CLASSES];      //!< number of successful allocations per size class
+    uint32_t failures;                          //!< number of allocations that could not be satisfied
+    uint32_t mallocCycles;                      //!< worst-case cycles spent in a single allocation
+    uint32_t freeCycles;                        //!< worst-case cycles spent in a single free
+};
+
+struct __malloc_free_stats
+{
+    uint32_t histogram[MALLOC_STATS_CLASSES];   //!< number of free fragments per size class
+    size_t largest;                             //!< largest free fragment or the contiguous free space, including block header
+};
+
+#endif
+
+#if MALLOC_REGIONS
+
+#ifndef MALLOC_HEAP_CLASS
+//! Class of memory of the primary heap, a combination of MALLOC_CLASS_* flags
+#define MALLOC_HEAP_CLASS   0
+#endif
+
+#endif
+
+//! Heap region in zero-wait-state memory (TCM, SRAM1), preferred for hot buffers
+#define MALLOC_CLASS_FAST   1
+//! Heap region accessible by DMA controllers
+#define MALLOC_CLASS_DMA    2
+
 struct __malloc_heap
 {
-    __malloc_free_list* free;
-    size_t fragments;
+#if MALLOC_SEGREGATED
+    __malloc_free_list* small[MALLOC_SMALL_BINS] = {};  //!< exact-size bins of small free blocks
+    __malloc_free_list* large = NULL;                   //!< free blocks larger than the biggest bin
+    uint32_t smallMask = 0;                             //!< bitmap of non-empty small bins
+#else
+    __malloc_free_list* free = NULL;
+#endif
+    size_t fragments = 0;
+#if MALLOC_POLICY == MALLOC_POLICY_NEXT
+    void* rover = NULL;                                 //!< next-fit searches start at this address
+#endif
     void* top = &__heap_start;
     void* limit = &__heap_end;
+#if MALLOC_STATS
+    __malloc_stats stats = {};
+#endif
+#if MALLOC_REGIONS
+    char* const start = &__heap_start;
+    char* const end = &__heap_end;
+    const uint32_t flags = MALLOC_HEAP_CLASS;   //!< combination of MALLOC_CLASS_* flags
+
+    // constexpr so that the heaps are constant-initialized and usable before any static constructor runs
+    constexpr __malloc_heap() {}
+    constexpr __malloc_heap(char* start, char* end, uint32_t flags)
+        : top(start), limit(end), start(start), end(end), flags(flags) {}
+
+    constexpr char* Start() { return start; }
+    constexpr char* End() { return end; }
+#else
+    constexpr char* Start() { return &__heap_start; }
+    constexpr char* End() { return &__heap_end; }
+#endif
 
-    constexpr size_t Total() { return &__heap_end - &__heap_start; }
-    constexpr size_t Committed() { return (char*)top - &__heap_start; }
+    constexpr bool Contains(const void* p) { return p >= Start() && p < End(); }
+    constexpr size_t Total() { return End() - Start(); }
+    constexpr size_t Committed() { return (char*)top - Start(); }
     constexpr size_t Fragments() { return fragments; }
     constexpr size_t Used() { return Committed() - fragments; }
     constexpr size_t ContiguousFree() { return (char*)limit - (char*)top; }
     constexpr size_t Free() { return ContiguousFree() + fragments; }
-    constexpr size_t Once() { return &__heap_end - (char*)limit; }
+    constexpr size_t Once() { return End() - (char*)limit; }
 };
 
 extern __malloc_heap __heap;
+
+#if MALLOC_REGIONS
+
+//! Declares an additional heap region between the linker symbols __heap_<name>_start and __heap_<name>_end
+#define MALLOC_REGION(name, cls) \
+    extern char __heap_ ## name ## _start, __heap_ ## name ## _end; \
+    INIT_PRIORITY(-10000) __malloc_heap __heap_ ## name(&__heap_ ## name ## _start, &__heap_ ## name ## _end, cls); \
+    static __attribute__((used, section(".rospec.malloc.heap." #name))) __malloc_heap* const UNIQUE(__malloc_region) = &__heap_ ## name
+
+//! Allocates memory from the specified heap region only
+extern void* malloc_region(__malloc_heap& heap, size_t size);
+//! Allocates memory from the first region having all the specified MALLOC_CLASS_* flags, falling back to any region
+extern void* malloc_class(uint32_t cls, size_t size);
+
+#else
+
+ALWAYS_INLINE void* malloc_class(uint32_t cls, size_t size) { return malloc(size); }
+
+#endif
+
+//! Allocates memory preferably from a zero-wait-state region
+ALWAYS_INLINE void* malloc_fast(size_t size) { return malloc_class(MALLOC_CLASS_FAST, size); }
+
+//! Permanently allocates memory with the specified power-of-two alignment, see malloc_once()
+extern void* malloc_once_aligned(size_t align, size_t size);
+
+//! Traced operations
+#define MALLOC_TRACE_MALLOC     1
+#define MALLOC_TRACE_CALLOC     2
+#define MALLOC_TRACE_REALLOC    3
+#define MALLOC_TRACE_FREE       4
+#define MALLOC_TRACE_TRIM       5
+#define MALLOC_TRACE_MEMALIGN   6
+
+//! Binary trace record, the same layout is used in the ring, the ITM stream and the output of malloc_trace_write()
+struct __malloc_trace_record
+{
+    uint32_t time;      //!< MONO_CLOCKS after the operation
+    uint32_t caller;    //!< return address of the call
+    uint32_t opSize;    //!< MALLOC_TRACE_* operation in the top 4 bits, requested size in the rest
+    uint32_t ptr;       //!< resulting pointer or the pointer being freed
+    uint32_t old;       //!< original pointer passed to realloc() or mtrim(), alignment requested from memalign()
+};
+
+#if MALLOC_TRACE
+
+#ifndef MALLOC_TRACE_RECORDS
+//! Number of records kept in the trace ring, must be a power of two
+#define MALLOC_TRACE_RECORDS    256
+#endif
+
+struct __malloc_trace_ring
+{
+    uint32_t head;      //!< free-running index of the next record to be written
+    uint32_t tail;      //!< free-running index of the oldest record not yet drained
+    uint32_t overruns;  //!< number of records lost because the ring was full
+    __malloc_trace_record records[MALLOC_TRACE_RECORDS];
+};
+
+extern __malloc_trace_ring __malloc_trace;
+
+//! Drains the trace ring to the specified file descriptor (e.g. a semihosting file), returns the number of records written or -1 on error
+extern int malloc_trace_write(int fd);
+
+#endif
+
+#if MALLOC_STATS
+//! Walks the free blocks to collect fragmentation statistics
+extern __malloc_free_stats malloc_free_stats(__malloc_heap& heap = __heap);
+//! Dumps all heap statistics to the malloc debug channel
+extern void malloc_stats_dump();
+//! Resets the allocation counters and worst-case timings
+extern void malloc_stats_reset();
+#endif
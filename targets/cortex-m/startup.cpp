@@ -143,6 +143,170 @@ void Cortex_ResetIRQHandler(IRQn_Type IRQn)
 __attribute__((used, section(".rospec.hwinit.fn"))) static handler_t __hwinit_start[] = {};
 __attribute__((used, section(".rospec.hwinit.fn1"))) static handler_t __hwinit_end[] = {};
 
+//! Copies whole words in bursts of four, both pointers must be word aligned
+static ALWAYS_INLINE void Startup_Copy(void* dst, const void* src, size_t len)
+{
+    __asm volatile (
+        "subs %[len], #16\n"
+        "blo 2f\n"
+        "1:\n"
+        "ldmia %[src]!, {r3, r4, r5, r12}\n"
+        "stmia %[dst]!, {r3, r4, r5, r12}\n"
+        "subs %[len], #16\n"
+        "bhs 1b\n"
+        "2:\n"
+        // the low bits of len are still valid, C == two words remaining, N == one word remaining
+        "lsls %[len], %[len], #29\n"
+        "itt cs\n"
+        "ldmcs %[src]!, {r3, r4}\n"
+        "stmcs %[dst]!, {r3, r4}\n"
+        "itt mi\n"
+        "ldrmi r3, [%[src]]\n"
+        "strmi r3, [%[dst]]\n"
+        : [dst] "+r" (dst), [src] "+r" (src), [len] "+r" (len) : : "r3", "r4", "r5", "r12", "cc", "memory"
+    );
+}
+
+//! Clears whole words in bursts of four, the pointer must be word aligned
+static ALWAYS_INLINE void Startup_Zero(void* dst, size_t len)
+{
+    __asm volatile (
+        "movs r3, #0\n"
+        "movs r4, #0\n"
+        "movs r5, #0\n"
+        "mov r12, r3\n"
+        "subs %[len], #16\n"
+        "blo 2f\n"
+        "1:\n"
+        "stmia %[dst]!, {r3, r4, r5, r12}\n"
+        "subs %[len], #16\n"
+        "bhs 1b\n"
+        "2:\n"
+        // the low bits of len are still valid, C == two words remaining, N == one word remaining
+        "lsls %[len], %[len], #29\n"
+        "it cs\n"
+        "stmcs %[dst]!, {r3, r4}\n"
+        "it mi\n"
+        "strmi r3, [%[dst]]\n"
+        : [dst] "+r" (dst), [len] "+r" (len) : : "r3", "r4", "r5", "r12", "cc", "memory"
+    );
+}
+
+#if CORTEX_DATA_COMPRESSION
+
+//! Load image produced by tools/datacompress starts with this word instead of __data_format
+#define CORTEX_DATA_COMPRESSION_MAGIC   0x315A4C44  // 'DLZ1'
+
+//! First word of .data, zero in an uncompressed load image
+__attribute__((used, section(".data.format"))) uint32_t __data_format = 0;
+
+//! Unpacks the compressed .data load image, see tools/datacompress for the format
+static void Startup_Unpack(uint8_t* dst, const uint8_t* src, const uint8_t* end)
+{
+    while (dst < end)
+    {
+        unsigned c = *src++;
+        if (c < 0x80)
+        {
+            // literal bytes
+            for (c++; c; c--)
+            {
+                *dst++ = *src++;
+            }
+        }
+        else
+        {
+            // match, may overlap with the output when repeating a short sequence
+            const uint8_t* from = dst - (src[0] | src[1] << 8);
+            src += 2;
+            for (c = c - 0x80 + 3; c; c--)
+            {
+                *dst++ = *from++;
+            }
+        }
+    }
+}
+
+#endif
+
+#if CORTEX_BOOT_PROFILE
+
+//! Boot profile of the current boot, .bss is zeroed before the first function is measured
+Cortex_BootProfile __boot_profile;
+
+//! Calls an initialization function, measuring its duration
+static void Startup_Call(handler_t fn)
+{
+    uint32_t t = CORTEX_BOOT_PROFILE_CLOCK();
+    fn();
+    auto& bp = __boot_profile;
+    if (bp.count < CORTEX_BOOT_PROFILE)
+    {
+        bp.entries[bp.count++] = { fn, CORTEX_BOOT_PROFILE_CLOCK() - t };
+    }
+}
+
+void Cortex_BootProfileDump()
+{
+    auto& bp = __boot_profile;
+    for (uint32_t i = 0; i < bp.count; i++)
+    {
+        // the format is parsed by tools/bootprofile/bootprofile.py, which resolves the addresses
+        DBGCL("boot", "%s %08X: %u cycles", i < bp.hwinit ? "hwinit" : "init", bp.entries[i].fn, bp.entries[i].cycles);
+    }
+    DBGCL("boot", "%u cycles to main()", bp.main);
+}
+
+#else
+
+#define Startup_Call(fn)    (fn)()
+
+#endif
+
+// deferred initializers, see CORTEX_DEFERRED_INIT
+__attribute__((used, section(".rospec.deferred.fn"))) static Cortex_DeferredInit* const __deferred_start[] = {};
+__attribute__((used, section(".rospec.deferred.fn1"))) static Cortex_DeferredInit* const __deferred_end[] = {};
+
+//! Initializers before this one have already run
+static Cortex_DeferredInit* const* s_deferredNext = __deferred_start;
+
+bool Cortex_DeferredInitStep()
+{
+    while (s_deferredNext < __deferred_end)
+    {
+        // the initializer may have run already on first access
+        if ((*s_deferredNext++)->Run())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Cortex_DeferredInitAll()
+{
+    while (Cortex_DeferredInitStep());
+}
+
+bool Cortex_DeferredInit::RunPending()
+{
+    {
+        PLATFORM_CRITICAL_SECTION();
+        // another context (e.g. a preempted worker) is in the middle of the initializer,
+        // returning now would let the caller use a half-initialized subsystem
+        ASSERT(state != Running);
+        if (state != Pending)
+        {
+            return false;
+        }
+        state = Running;
+    }
+
+    fn();
+    state = Done;
+    return true;
+}
+
 extern handler_t __init_array_start[];
 extern handler_t __init_array_end[];
 extern int main(int argc, char** argv);
@@ -158,6 +322,15 @@ extern "C" __attribute__((noreturn)) void Default_Reset_Handler()
     );
 #endif
 
+#if CORTEX_BOOT_PROFILE
+    // the cycle counter is used to measure everything until main()
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    // .bss is not zeroed yet, the start time is kept on the stack
+    uint32_t bootStart = CORTEX_BOOT_PROFILE_CLOCK();
+#endif
+
     SCB->EnableFPU();
     SCB->EnableFaults();
     SCB->EnableSevOnPend();
@@ -172,10 +345,19 @@ extern "C" __attribute__((noreturn)) void Default_Reset_Handler()
 #endif
 
     // copy pre-initialized RW data
-    memcpy(&__data_start, &__data_load, &__data_end - &__data_start);
+#if CORTEX_DATA_COMPRESSION
+    if (*(const uint32_t*)&__data_load == CORTEX_DATA_COMPRESSION_MAGIC)
+    {
+        Startup_Unpack((uint8_t*)&__data_start, (const uint8_t*)&__data_load + 4, (const uint8_t*)&__data_end);
+    }
+    else
+#endif
+    {
+        Startup_Copy(&__data_start, &__data_load, &__data_end - &__data_start);
+    }
 
-    // zeroing of BSS
-    memset(&__bss_start, 0, &__bss_end - &__bss_start);
+    // zeroing of BSS, .nobss is left untouched
+    Startup_Zero(&__bss_start, &__bss_end - &__bss_start);
 
     // prepare the ISR table
     // do not touch entry 0, as it's not a real ISR and is may be used by bootloaders for communication
@@ -203,9 +385,13 @@ extern "C" __attribute__((noreturn)) void Default_Reset_Handler()
 
     for (handler_t* initptr = __hwinit_start; initptr < __hwinit_end; initptr++)
     {
-        (*initptr)();
+        Startup_Call(*initptr);
     }
 
+#if CORTEX_BOOT_PROFILE
+    __boot_profile.hwinit = __boot_profile.count;
+#endif
+
 #if BOOTLOADER
     DBGS("============= BOOTLOADER =============\n");
 #else
@@ -223,13 +409,17 @@ extern "C" __attribute__((noreturn)) void Default_Reset_Handler()
 #if DEBUG
         DBG("init: %08X\n", *initptr);
 #endif
-        (*initptr)();
+        Startup_Call(*initptr);
     }
 
 #ifdef CORTEX_STARTUP_BEFORE_MAIN
     CORTEX_STARTUP_BEFORE_MAIN();
 #endif
 
+#if CORTEX_BOOT_PROFILE
+    __boot_profile.main = CORTEX_BOOT_PROFILE_CLOCK() - bootStart;
+#endif
+
     // finally
     DBG("init: starting main()\n");
 #ifdef CORTEX_STARTUP_MAIN
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2026 triaxis s.r.o.
+# Licensed under the MIT license. See LICENSE.txt file in the repository root
+# for full license information.
+#
+# cortex-m/tools/bootprofile/bootprofile.py
+#
+# Symbolizes the boot profile printed by Cortex_BootProfileDump()
+#
+# The target has no symbol table, so the dump contains only the addresses
+# of the measured functions, one line per function:
+#
+#   hwinit 0800123D: 1520 cycles
+#   init 08004A11: 87 cycles
+#   ...
+#   20714 cycles to main()
+#
+# The lines may carry any prefix added by the debug output (timestamps,
+# channel names). The addresses are resolved against the firmware ELF with
+# addr2line and the functions are listed from the slowest one.
+#
+# Usage: bootprofile.py [--addr2line arm-none-eabi-addr2line] firmware.elf [log]
+#
+
+import argparse
+import re
+import subprocess
+import sys
+
+ENTRY = re.compile(r'\b(hwinit|init) ([0-9A-Fa-f]{8}): (\d+) cycles')
+MAIN = re.compile(r'\b(\d+) cycles to main\(\)')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Symbolizes the boot profile of a Cortex-M firmware')
+    parser.add_argument('--addr2line', default='arm-none-eabi-addr2line')
+    parser.add_argument('elf')
+    parser.add_argument('log', nargs='?', type=argparse.FileType('r'), default=sys.stdin)
+    args = parser.parse_args()
+
+    entries = []
+    total = None
+    for line in args.log:
+        m = ENTRY.search(line)
+        if m:
+            # function pointers have the Thumb bit set
+            entries.append((m.group(1), int(m.group(2), 16) & ~1, int(m.group(3))))
+            continue
+        m = MAIN.search(line)
+        if m:
+            total = int(m.group(1))
+
+    if not entries:
+        sys.exit('no boot profile found in the input')
+
+    out = subprocess.check_output([args.addr2line, '-f', '-C', '-e', args.elf] + ['%08X' % addr for _, addr, _ in entries], text=True)
+    names = out.splitlines()[0::2]
+
+    print('%-6s  %-8s  %10s  %6s  %s' % ('phase', 'address', 'cycles', 'share', 'function'))
+    for (phase, addr, cycles), name in sorted(zip(entries, names), key=lambda e: -e[0][2]):
+        share = '%5.1f%%' % (cycles * 100.0 / total) if total else ''
+        print('%-6s  %08X  %10d  %6s  %s' % (phase, addr, cycles, share, name))
+
+    if total is not None:
+        print('%d cycles to main(), %d in measured functions' % (total, sum(e[2] for e in entries)))
+
+
+if __name__ == '__main__':
+    main()
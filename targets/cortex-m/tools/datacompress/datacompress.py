@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2026 triaxis s.r.o.
+# Licensed under the MIT license. See LICENSE.txt file in the repository root
+# for full license information.
+#
+# cortex-m/tools/datacompress/datacompress.py
+#
+# Post-link step replacing the .data load image of a firmware built with
+# CORTEX_DATA_COMPRESSION with a compressed one, unpacked by the reset handler
+#
+# The image starts with a magic word (in place of the zero __data_format word
+# the linker puts at the start of .data), followed by a stream of tokens:
+#
+#   0nnnnnnn                    n + 1 literal bytes follow
+#   1nnnnnnn dddddddd dddddddd  copy n + 3 bytes from d (little-endian) bytes back
+#
+# The stream ends when the whole .data section is unpacked. The image is left
+# unchanged if compression does not make it smaller.
+#
+# The .sig section following the load image in flash is moved down by the
+# space saved (in whole words), so that no gap is left before it. The
+# __data_load_end symbol is resolved at link time and cannot be updated,
+# in a compressed image it still points to the end of the uncompressed
+# load image - use the end of .sig or of the binary output instead.
+#
+# Usage: datacompress.py [--objcopy arm-none-eabi-objcopy] input.axf output.axf
+#
+
+import argparse
+import os
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+
+MAGIC = 0x315A4C44      # 'DLZ1', must match CORTEX_DATA_COMPRESSION_MAGIC in startup.cpp
+
+MIN_MATCH = 3
+MAX_MATCH = 0x7F + MIN_MATCH
+MAX_LITERALS = 0x80
+MAX_DISTANCE = 0xFFFF
+MAX_CANDIDATES = 64
+
+
+def compress(data):
+    out = bytearray()
+    literals = bytearray()
+    chains = {}
+    i = 0
+
+    def flush():
+        for n in range(0, len(literals), MAX_LITERALS):
+            chunk = literals[n:n + MAX_LITERALS]
+            out.append(len(chunk) - 1)
+            out.extend(chunk)
+        literals.clear()
+
+    def remember(pos):
+        if pos + MIN_MATCH <= len(data):
+            chains.setdefault(bytes(data[pos:pos + MIN_MATCH]), []).append(pos)
+
+    while i < len(data):
+        bestLen = bestDist = 0
+        for cand in reversed(chains.get(bytes(data[i:i + MIN_MATCH]), [])[-MAX_CANDIDATES:]):
+            dist = i - cand
+            if dist > MAX_DISTANCE:
+                break
+            n = 0
+            # overlapping matches are fine, the decompressor copies byte by byte
+            while n < MAX_MATCH and i + n < len(data) and data[cand + n] == data[i + n]:
+                n += 1
+            if n > bestLen:
+                bestLen, bestDist = n, dist
+                if n == MAX_MATCH:
+                    break
+
+        if bestLen >= MIN_MATCH:
+            flush()
+            out.append(0x80 | (bestLen - MIN_MATCH))
+            out.extend(struct.pack('<H', bestDist))
+            for n in range(bestLen):
+                remember(i + n)
+            i += bestLen
+        else:
+            literals.append(data[i])
+            remember(i)
+            i += 1
+
+    flush()
+    return bytes(out)
+
+
+def decompress(stream, size):
+    out = bytearray()
+    i = 0
+    while len(out) < size:
+        c = stream[i]
+        i += 1
+        if c < 0x80:
+            out.extend(stream[i:i + c + 1])
+            i += c + 1
+        else:
+            dist = struct.unpack_from('<H', stream, i)[0]
+            i += 2
+            for n in range((c & 0x7F) + MIN_MATCH):
+                out.append(out[-dist])
+    return bytes(out)
+
+
+def move_section_lma(path, name, delta):
+    """
+    Moves the load address of the segment containing the named section,
+    objcopy --change-section-lma refuses to do that for linked images
+    """
+    with open(path, 'r+b') as f:
+        elf = bytearray(f.read())
+        if elf[:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1:
+            sys.exit('%s: not a 32-bit little-endian ELF file' % path)
+
+        phoff, shoff = struct.unpack_from('<II', elf, 0x1C)
+        phentsize, phnum, shentsize, shnum, shstrndx = struct.unpack_from('<HHHHH', elf, 0x2A)
+
+        strtab = struct.unpack_from('<I', elf, shoff + shstrndx * shentsize + 0x10)[0]
+        for i in range(shnum):
+            sh = shoff + i * shentsize
+            nameoff, _, _, addr, _, size = struct.unpack_from('<IIIIII', elf, sh)
+            if elf[strtab + nameoff:].split(b'\0', 1)[0] == name.encode() and size:
+                break
+        else:
+            return False
+
+        for i in range(phnum):
+            ph = phoff + i * phentsize
+            ptype, _, vaddr, paddr, filesz = struct.unpack_from('<IIIII', elf, ph)
+            # PT_LOAD
+            if ptype == 1 and filesz and vaddr <= addr < vaddr + filesz:
+                if vaddr != addr:
+                    sys.exit('%s: %s does not start its segment, cannot move it' % (path, name))
+                struct.pack_into('<I', elf, ph + 0x0C, paddr + delta)
+                f.seek(0)
+                f.write(elf)
+                return True
+
+    return False
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compresses the .data load image of a Cortex-M firmware')
+    parser.add_argument('--objcopy', default='arm-none-eabi-objcopy')
+    parser.add_argument('input')
+    parser.add_argument('output')
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as tmp:
+        raw = os.path.join(tmp, 'data.bin')
+        packed = os.path.join(tmp, 'data.dlz')
+        subprocess.check_call([args.objcopy, '-O', 'binary', '--only-section=.data', args.input, raw])
+        with open(raw, 'rb') as f:
+            data = f.read()
+
+        if len(data) < 4 or struct.unpack_from('<I', data)[0] != 0:
+            sys.exit('%s: .data does not start with __data_format, is CORTEX_DATA_COMPRESSION enabled?' % args.input)
+
+        stream = compress(data)
+        if decompress(stream, len(data)) != data:
+            sys.exit('%s: compression self-check failed' % args.input)
+
+        image = struct.pack('<I', MAGIC) + stream
+        if len(image) >= len(data):
+            print('.data: %d bytes, not compressible' % len(data))
+            shutil.copyfile(args.input, args.output)
+            return
+
+        with open(packed, 'wb') as f:
+            f.write(image)
+        subprocess.check_call([args.objcopy, '--update-section', '.data=' + packed, args.input, args.output])
+
+        # .sig was placed right after the uncompressed image, keep it word aligned
+        saved = (len(data) - len(image)) & ~3
+        if saved and move_section_lma(args.output, '.sig', -saved):
+            print('.sig: moved down by %d bytes' % saved)
+        print('.data: %d -> %d bytes' % (len(data), len(image)))
+
+
+if __name__ == '__main__':
+    main()
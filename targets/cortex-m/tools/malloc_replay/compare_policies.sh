@@ -0,0 +1,61 @@
+#!/bin/sh
+#
+# Copyright (c) 2026 triaxis s.r.o.
+# Licensed under the MIT license. See LICENSE.txt file in the repository root
+# for full license information.
+#
+# cortex-m/tools/malloc_replay/compare_policies.sh
+#
+# Builds malloc_replay once for every MALLOC_POLICY, replays the same trace
+# with each of them and tabulates the peak heap usage and fragmentation
+#
+# Additional compiler flags select the other allocator options, use the same
+# ones as the firmware the trace was recorded on, e.g.
+#
+#   compare_policies.sh -s 65536 trace.bin -DMALLOC_SEGREGATED=1
+#
+# Usage: compare_policies.sh [-s heap size] trace.bin [compiler flags...]
+#
+
+set -e
+
+DIR=$(dirname "$0")
+CXX=${CXX:-g++}
+
+HEAP=
+if [ "$1" = "-s" ]; then
+    HEAP="-s $2"
+    shift 2
+fi
+
+if [ $# -lt 1 ]; then
+    echo "Usage: $0 [-s heap size] trace.bin [compiler flags...]" >&2
+    exit 1
+fi
+
+TRACE=$1
+shift
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+printf "%-6s %14s %10s %12s %14s %9s\n" policy peak_committed peak_used worst_holes worst_external diverged
+
+for POLICY in first:0 best:1 next:2 good:3; do
+    NAME=${POLICY%:*}
+    $CXX -m32 -std=gnu++17 -O2 -DMALLOC_HOST=1 -DMALLOC_STATS=1 -DMALLOC_POLICY=${POLICY#*:} "$@" \
+        -I"$DIR/host" -I"$DIR/../.." "$DIR/../../malloc.cpp" "$DIR/malloc_replay.cpp" -o "$TMP/replay_$NAME"
+    # the heap dump printed to stderr is shown only if the replay fails
+    if ! "$TMP/replay_$NAME" $HEAP -n 0 "$TRACE" > "$TMP/$NAME.txt" 2> "$TMP/$NAME.err"; then
+        cat "$TMP/$NAME.err" >&2
+        exit 1
+    fi
+
+    awk -v name="$NAME" '
+        /^unknown pointers/ { diverged = $6; sub(",", "", diverged) }
+        /^heap .*peak committed/ { committed = $5; used = $8; sub(",", "", committed) }
+        /^worst holes/ { holes = $3 }
+        /^worst external fragmentation/ { external = $4 }
+        END { printf "%-6s %14s %10s %12s %14s %9s\n", name, committed, used, holes, external, diverged }
+    ' "$TMP/$NAME.txt"
+done
@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2026 triaxis s.r.o.
+ * Licensed under the MIT license. See LICENSE.txt file in the repository root
+ * for full license information.
+ *
+ * cortex-m/tools/malloc_replay/host/base/alloc_trace.h
+ *
+ * Allocation tracing hooks are not used by the replay
+ */
+
+#pragma once
+
+#ifndef ALLOC_TRACE_OVERHEAD
+//! Must match the overhead of the traced firmware for the replay to use the same block sizes
+#define ALLOC_TRACE_OVERHEAD    0
+#endif
+
+#define __trace_alloc(ptr, size)
+#define __trace_free(ptr)
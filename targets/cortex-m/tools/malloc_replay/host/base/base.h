@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026 triaxis s.r.o.
+ * Licensed under the MIT license. See LICENSE.txt file in the repository root
+ * for full license information.
+ *
+ * cortex-m/tools/malloc_replay/host/base/base.h
+ *
+ * Minimal replacement of the core base.h allowing malloc.cpp to be built natively
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define OPTIMIZE
+#define INIT_PRIORITY(n)
+#define ALWAYS_INLINE   inline __attribute__((always_inline))
+
+#define BIT(n)          (1u << (n))
+#define GETBIT(v, n)    (((v) >> (n)) & 1)
+
+#define _CONCAT(a, b)   a ## b
+#define CONCAT(a, b)    _CONCAT(a, b)
+#define UNIQUE(name)    CONCAT(name, __LINE__)
+
+#define ASSERT          assert
+
+#define DBGCL(channel, ...) (fprintf(stderr, channel ": " __VA_ARGS__), fputc('\n', stderr))
+#define DBGC(channel, ...)  fprintf(stderr, channel ": " __VA_ARGS__)
+#define _DBG(...)           fprintf(stderr, __VA_ARGS__)
+
+// the replay is single-threaded and there is no cycle counter
+#define PLATFORM_CRITICAL_SECTION()
+#define MALLOC_CYCLE_COUNT  0
+
+static inline uint32_t __get_IPSR() { return 0; }
+
+struct _reent;
+
+// keep the host C library allocator for the tool itself
+#define malloc          replay_malloc
+#define calloc          replay_calloc
+#define realloc         replay_realloc
+#define free            replay_free
+#define _malloc_r       replay_malloc_r
+#define _free_r         replay_free_r
+#define memalign        replay_memalign
+#define aligned_alloc   replay_aligned_alloc
+#define posix_memalign  replay_posix_memalign
+#define _memalign_r     replay_memalign_r
+
+void* malloc(size_t size);
+void* calloc(size_t size, size_t count);
+void* realloc(void* ptr, size_t size);
+void free(void* ptr);
+void* memalign(size_t align, size_t size);
+void* mtrim(void* ptr, size_t size);
+void* malloc_once(size_t size);
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2026 triaxis s.r.o.
+ * Licensed under the MIT license. See LICENSE.txt file in the repository root
+ * for full license information.
+ *
+ * cortex-m/tools/malloc_replay/malloc_replay.cpp
+ *
+ * Replays a binary trace recorded by a firmware built with MALLOC_TRACE
+ * against the same allocator compiled natively and reports the peak heap
+ * usage, fragmentation and the hottest allocation call sites.
+ *
+ * Build with the same allocator options as the firmware (or different ones
+ * to compare them), -m32 is needed to get the same block layout:
+ *
+ *   g++ -m32 -std=gnu++17 -O2 -DMALLOC_HOST=1 -DMALLOC_STATS=1 [-DMALLOC_POLICY=...] \
+ *       -Ihost -I../.. ../../malloc.cpp malloc_replay.cpp -o malloc_replay
+ *
+ * Usage: malloc_replay [-s heap size] [-n call sites] trace.bin
+ *
+ * Call site addresses can be resolved using addr2line -e firmware.elf
+ *
+ * compare_policies.sh replays one trace with every MALLOC_POLICY and tabulates the results
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+#include <malloc_internal.h>
+
+#if !MALLOC_STATS
+#error malloc_replay requires MALLOC_STATS
+#endif
+
+#ifndef REPLAY_HEAP_SIZE
+#define REPLAY_HEAP_SIZE    (16 << 20)
+#endif
+
+#define _STRINGIFY(x)   #x
+#define STRINGIFY(x)    _STRINGIFY(x)
+
+// heap normally provided by the linker script
+__asm__(
+    ".bss\n"
+    ".balign 16\n"
+    ".globl __heap_start\n"
+    "__heap_start:\n"
+    ".space " STRINGIFY(REPLAY_HEAP_SIZE) "\n"
+    ".globl __heap_end\n"
+    "__heap_end:\n"
+    ".text\n");
+
+struct CallSite
+{
+    uint32_t caller;
+    uint32_t allocs;
+    uint64_t bytes;
+    uint32_t failures;
+};
+
+int main(int argc, char** argv)
+{
+    size_t heapSize = 0;
+    size_t topSites = 10;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': heapSize = strtoul(optarg, NULL, 0); break;
+            case 'n': topSites = strtoul(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "Usage: %s [-s heap size] [-n call sites] trace.bin\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        fprintf(stderr, "Usage: %s [-s heap size] [-n call sites] trace.bin\n", argv[0]);
+        return 2;
+    }
+
+    FILE* f = fopen(argv[optind], "rb");
+    if (!f)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    if (heapSize)
+    {
+        if (heapSize > __heap.Total())
+        {
+            fprintf(stderr, "heap size limited to %zu bytes\n", __heap.Total());
+        }
+        else
+        {
+            __heap.limit = __heap.Start() + heapSize;
+        }
+    }
+
+    std::unordered_map<uint32_t, void*> live;   // firmware pointer -> replayed block
+    std::unordered_map<uint32_t, CallSite> sites;
+
+    auto take = [&](uint32_t ptr) -> void*
+    {
+        auto it = live.find(ptr);
+        if (it == live.end())
+        {
+            return NULL;
+        }
+        void* res = it->second;
+        live.erase(it);
+        return res;
+    };
+
+    size_t records = 0, unknown = 0, diverged = 0;
+    size_t peakCommitted = 0, peakUsed = 0;
+    double worstHoles = 0, worstExternal = 0;
+    size_t worstHolesAt = 0, worstExternalAt = 0;
+    uint32_t firstTime = 0, lastTime = 0;
+
+    __malloc_trace_record rec;
+    while (fread(&rec, sizeof(rec), 1, f) == 1)
+    {
+        unsigned op = rec.opSize >> 28;
+        size_t size = rec.opSize & 0x0FFFFFFF;
+        void* res = NULL;
+
+        if (!records++)
+        {
+            firstTime = rec.time;
+        }
+        lastTime = rec.time;
+
+        switch (op)
+        {
+            case MALLOC_TRACE_MALLOC:
+            case MALLOC_TRACE_CALLOC:
+            case MALLOC_TRACE_MEMALIGN:
+                res = op == MALLOC_TRACE_CALLOC ? calloc(size, 1) :
+                    op == MALLOC_TRACE_MEMALIGN ? memalign(rec.old, size) :
+                    malloc(size);
+                if (!res != !rec.ptr)
+                {
+                    diverged++;
+                }
+                if (!rec.ptr)
+                {
+                    // failed in the firmware, keep the replay in sync
+                    free(res);
+                }
+                else if (res)
+                {
+                    live[rec.ptr] = res;
+                }
+                break;
+
+            case MALLOC_TRACE_REALLOC:
+            case MALLOC_TRACE_TRIM:
+            {
+                void* old = NULL;
+                if (rec.old && !(old = take(rec.old)))
+                {
+                    // allocated before the trace started, or the record was lost
+                    unknown++;
+                    continue;
+                }
+                res = op == MALLOC_TRACE_TRIM ? mtrim(old, size) : realloc(old, size);
+                if (!res != !rec.ptr)
+                {
+                    diverged++;
+                }
+                // the original block is kept when reallocation fails
+                if (void* keep = res ? res : old)
+                {
+                    live[rec.ptr ? rec.ptr : rec.old] = keep;
+                }
+                break;
+            }
+
+            case MALLOC_TRACE_FREE:
+                if (void* p = take(rec.ptr))
+                {
+                    free(p);
+                }
+                else
+                {
+                    unknown++;
+                }
+                break;
+
+            default:
+                fprintf(stderr, "invalid record %zu, operation %u\n", records - 1, op);
+                return 1;
+        }
+
+        if (op != MALLOC_TRACE_FREE)
+        {
+            auto& site = sites[rec.caller];
+            site.caller = rec.caller;
+            site.allocs++;
+            site.bytes += size;
+            if (!rec.ptr)
+            {
+                site.failures++;
+            }
+        }
+
+        peakCommitted = std::max(peakCommitted, __heap.Committed());
+        peakUsed = std::max(peakUsed, __heap.Used());
+
+        if (__heap.Committed())
+        {
+            // share of committed memory lost in holes
+            double holes = double(__heap.Fragments()) / __heap.Committed();
+            if (holes > worstHoles)
+            {
+                worstHoles = holes;
+                worstHolesAt = records - 1;
+            }
+        }
+
+        if (__heap.Fragments())
+        {
+            // share of free memory not usable for the largest possible allocation
+            double external = 1 - double(malloc_free_stats().largest) / __heap.Free();
+            if (external > worstExternal)
+            {
+                worstExternal = external;
+                worstExternalAt = records - 1;
+            }
+        }
+    }
+
+    fclose(f);
+
+    printf("records %zu, time %u..%u (%u clocks)\n", records, firstTime, lastTime, lastTime - firstTime);
+    printf("unknown pointers %zu, diverged results %zu, live at end %zu\n", unknown, diverged, live.size());
+    printf("heap %zu, peak committed %zu, peak used %zu\n", size_t((char*)__heap.limit - __heap.Start()), peakCommitted, peakUsed);
+    printf("committed %zu, used %zu, fragments %zu\n", __heap.Committed(), __heap.Used(), __heap.Fragments());
+    printf("worst holes %.1f%% of committed (record %zu)\n", worstHoles * 100, worstHolesAt);
+    printf("worst external fragmentation %.1f%% (record %zu)\n", worstExternal * 100, worstExternalAt);
+
+    std::vector<CallSite> hot;
+    for (auto& kv : sites)
+    {
+        hot.push_back(kv.second);
+    }
+    std::sort(hot.begin(), hot.end(), [](const CallSite& a, const CallSite& b) { return a.allocs > b.allocs; });
+    if (hot.size() > topSites)
+    {
+        hot.resize(topSites);
+    }
+
+    printf("\n%10s %10s %12s %8s\n", "caller", "allocs", "bytes", "failed");
+    for (auto& site : hot)
+    {
+        printf("0x%08X %10u %12llu %8u\n", site.caller, site.allocs, (unsigned long long)site.bytes, site.failures);
+    }
+
+    malloc_stats_dump();
+    return 0;
+}
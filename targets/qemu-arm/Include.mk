@@ -8,16 +8,50 @@
 # Makefile modifications to allow using qemu-system-arm for running tests
 #
 
+QEMU_ARM_MAKEFILE := $(call curmake)
+
 # prefix for test invocations
 TEST_RUN = qemu-system-arm -machine lm3s6965evb -monitor null -serial null -nographic -semihosting -kernel
 TEST_RUN_ARGS = -append "$(TEST_FILTERS)"
 
+# benchmarks run with a fixed instruction count per virtual nanosecond, so SysTick preemption
+# happens at the same points on every run - the measured times still come from the host clock,
+# see bench/bench.h
+BENCH_RUN = qemu-system-arm -machine lm3s6965evb -icount shift=0 -monitor null -serial null -nographic -semihosting -kernel
+
 # LM3S6965 is a Cortex-M3
 TARGETS += cortex-m3
 
 COMPONENTS += base
 
-.PHONY: run
+ifndef BENCH_BUILD
+
+.PHONY: run bench
 
 run: $(OUTPUT).elf
 	@$(TEST_RUN) $(OUTPUT).elf $(TEST_RUN_ARGS)
+
+# the benchmark program in bench/ is built once per variant, BENCH_DEFINES_<variant> are added to its DEFINES,
+# the boot profile is always enabled to measure the time from reset to main()
+BENCH_DIR = $(dir $(QEMU_ARM_MAKEFILE))bench/
+BENCH_OUTDIR = $(OBJDIR)bench/
+BENCH_CONFIG ?= Release
+BENCH_VARIANTS ?= default boundary best next good scheduler
+BENCH_DEFINES_boundary = MALLOC_BOUNDARY_TAGS=1
+BENCH_DEFINES_best = MALLOC_POLICY=1
+BENCH_DEFINES_next = MALLOC_POLICY=2
+BENCH_DEFINES_good = MALLOC_POLICY=3
+BENCH_DEFINES_scheduler = CORTEX_WORKER_SCHEDULER=1
+BENCH_RESULTS = $(BENCH_OUTDIR)bench.csv
+
+# results of all variants are collected in a single CSV file
+bench: $(addprefix bench-,$(BENCH_VARIANTS))
+	@(echo "name,value"; cat $(addprefix $(BENCH_OUTDIR),$(addsuffix .csv,$(BENCH_VARIANTS)))) > $(BENCH_RESULTS)
+	@cat $(BENCH_RESULTS)
+
+bench-%:
+	@DEFINES="CORTEX_BOOT_PROFILE=32 $(BENCH_DEFINES) $(BENCH_DEFINES_$*)" COMPONENTS="kernel $(BENCH_COMPONENTS)" TARGET="$(TARGET)" TARGETS="$(TARGETS)" \
+		$(MAKE) -f $(BASE_DIR)Base.mk BENCH_BUILD=1 PROJECT_SOURCE_DIR=$(BENCH_DIR) CONFIG=$(BENCH_CONFIG) OUTDIR=$(BENCH_OUTDIR)$*/ OBJDIR=$(BENCH_OUTDIR)$*/obj/ NAME=bench main
+	@$(BENCH_RUN) $(BENCH_OUTDIR)$*/bench$(PRIMARY_EXT) -append "$*" > $(BENCH_OUTDIR)$*.csv
+
+endif
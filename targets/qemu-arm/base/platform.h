@@ -29,4 +29,7 @@ END_EXTERN_C
 
 #define SystemCoreClock 32000000
 
+// QEMU does not model the DWT cycle counter, the semihosting clock (in nanoseconds) is converted to core clock cycles
+#define CORTEX_BOOT_PROFILE_CLOCK()     uint32_t(angel_clock() * (SystemCoreClock / 1000000) / 1000)
+
 #include_next <base/platform.h>
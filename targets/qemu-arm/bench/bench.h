@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2026 triaxis s.r.o.
+ * Licensed under the MIT license. See LICENSE.txt file in the repository root
+ * for full license information.
+ *
+ * qemu-arm/bench/bench.h
+ *
+ * Micro-benchmarks of the Cortex-M platform layer, run using make bench
+ *
+ * Every case prints one <variant>.<case>,<value> line, values are core clock cycles
+ * per operation unless the case name ends with _bytes. Cycles come from the DWT cycle
+ * counter when it runs, QEMU does not model it, so the semihosting clock converted
+ * using SystemCoreClock is used instead - such results are only comparable between
+ * builds measured on the same host.
+ */
+
+#pragma once
+
+#include <kernel/kernel.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//! Name of the build variant, passed on the command line
+extern const char* Bench_Variant;
+
+//! Selects the clock used for measurements
+extern void Bench_Init();
+//! Returns the current time in core clock cycles
+extern uint32_t Bench_Cycles();
+//! Prints a single result line
+extern void Bench_Report(const char* name, uint32_t value);
+
+//! Runs the heap benchmarks
+extern void Bench_Heap();
+//! Runs the interrupt dispatch benchmarks
+extern void Bench_IRQ();
+//! Runs the worker switching benchmarks, exits when done
+extern async(Bench_Workers);
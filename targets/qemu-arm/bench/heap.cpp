@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2026 triaxis s.r.o.
+ * Licensed under the MIT license. See LICENSE.txt file in the repository root
+ * for full license information.
+ *
+ * qemu-arm/bench/heap.cpp
+ *
+ * Heap benchmarks
+ *
+ * heap_free         free() of blocks surrounded by used ones with a growing free list, compare
+ *                   the address-ordered chain walk (default) with MALLOC_BOUNDARY_TAGS (boundary)
+ * heap_mix          mixed malloc()/free() workload, compare the MALLOC_POLICY variants
+ *                   (default is first-fit, best, next, good)
+ * heap_mix.peak_bytes      highest heap break reached by the workload
+ * heap_mix.holes_bytes     free fragments below the break at the end of the workload
+ */
+
+#include "bench.h"
+
+#include <malloc_internal.h>
+
+#ifndef BENCH_HEAP_BLOCKS
+#define BENCH_HEAP_BLOCKS   256
+#endif
+
+#ifndef BENCH_HEAP_OPS
+#define BENCH_HEAP_OPS      4096
+#endif
+
+static uint32_t s_seed;
+
+//! Deterministic pseudo-random sequence, the same in all variants
+static uint32_t Random()
+{
+    return s_seed = s_seed * 1664525 + 1013904223;
+}
+
+static void Bench_Free()
+{
+    void* blocks[BENCH_HEAP_BLOCKS];
+    s_seed = 1;
+    for (auto& p : blocks)
+    {
+        p = malloc(16 + (Random() >> 26));
+    }
+
+    // every other block is freed from the bottom up, each one is surrounded by used blocks,
+    // so nothing merges and the free list grows by one block per free - an address-ordered
+    // chain has to be walked to its end every time
+    uint32_t t = Bench_Cycles();
+    for (unsigned i = 0; i < BENCH_HEAP_BLOCKS; i += 2)
+    {
+        free(blocks[i]);
+    }
+    Bench_Report("heap_free", (Bench_Cycles() - t) / (BENCH_HEAP_BLOCKS / 2));
+
+    for (unsigned i = 1; i < BENCH_HEAP_BLOCKS; i += 2)
+    {
+        free(blocks[i]);
+    }
+}
+
+static void Bench_Mix()
+{
+    // 64 slots, each either empty or holding a live block
+    void* live[64] = {};
+    size_t base = __heap.Committed(), peak = base;
+    s_seed = 7;
+
+    uint32_t t = Bench_Cycles();
+    for (unsigned i = 0; i < BENCH_HEAP_OPS; i++)
+    {
+        auto& slot = live[Random() >> 26];
+        if (slot)
+        {
+            free(slot);
+            slot = NULL;
+            continue;
+        }
+
+        // mostly small blocks, one in four is a larger buffer
+        uint32_t r = Random();
+        slot = malloc(r >> 30 ? 8 + (r >> 20 & 63) : 64 + (r >> 16 & 255));
+        if (__heap.Committed() > peak)
+        {
+            peak = __heap.Committed();
+        }
+    }
+    t = Bench_Cycles() - t;
+    size_t holes = __heap.Fragments();
+
+    for (auto p : live)
+    {
+        free(p);
+    }
+
+    Bench_Report("heap_mix", t / BENCH_HEAP_OPS);
+    Bench_Report("heap_mix.peak_bytes", peak - base);
+    Bench_Report("heap_mix.holes_bytes", holes);
+}
+
+void Bench_Heap()
+{
+    // the workload runs first, on a heap that has not been fragmented yet
+    Bench_Mix();
+    Bench_Free();
+}
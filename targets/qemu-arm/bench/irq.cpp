@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2026 triaxis s.r.o.
+ * Licensed under the MIT license. See LICENSE.txt file in the repository root
+ * for full license information.
+ *
+ * qemu-arm/bench/irq.cpp
+ *
+ * Interrupt dispatch benchmarks
+ *
+ * irq_delegate      pending an interrupt and returning from its handler, dispatched
+ *                   through Interrupt_Handler and the Delegate table
+ * irq_direct        the same with the handler installed by Cortex_SetDirectIRQHandler
+ *
+ * The fallback CMSIS header of qemu-arm has no external IRQs, PendSV stands in for one.
+ */
+
+#include "bench.h"
+
+#ifndef BENCH_IRQ_ROUNDS
+#define BENCH_IRQ_ROUNDS    1000
+#endif
+
+struct IrqCounter
+{
+    volatile uint32_t count;
+
+    void Handle() { count++; }
+};
+
+static IrqCounter s_counter;
+
+//! Triggers the interrupt the specified number of times, returns cycles per round trip
+static uint32_t IrqRoundTrips()
+{
+    s_counter.count = 0;
+    uint32_t t = Bench_Cycles();
+    for (unsigned i = 0; i < BENCH_IRQ_ROUNDS; i++)
+    {
+        // the handler runs right after the barriers
+        SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+        __DSB();
+        __ISB();
+    }
+    t = Bench_Cycles() - t;
+    ASSERT(s_counter.count == BENCH_IRQ_ROUNDS);
+    return t / BENCH_IRQ_ROUNDS;
+}
+
+void Bench_IRQ()
+{
+    NVIC_SetPriority(PendSV_IRQn, CORTEX_MAXIMUM_PRIO);
+
+    Cortex_SetIRQHandler(PendSV_IRQn, GetDelegate(&s_counter, &IrqCounter::Handle));
+    Bench_Report("irq_delegate", IrqRoundTrips());
+
+    Cortex_SetDirectIRQHandler<&s_counter, &IrqCounter::Handle>(PendSV_IRQn);
+    Bench_Report("irq_direct", IrqRoundTrips());
+
+    Cortex_ResetIRQHandler(PendSV_IRQn);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026 triaxis s.r.o.
+ * Licensed under the MIT license. See LICENSE.txt file in the repository root
+ * for full license information.
+ *
+ * qemu-arm/bench/main.cpp
+ *
+ * Benchmark runner, synchronous cases run first, worker cases from the scheduler
+ *
+ * boot_main         reset to main(), measured by the startup code (CORTEX_BOOT_PROFILE)
+ */
+
+#include "bench.h"
+
+const char* Bench_Variant = "default";
+
+static bool s_cycleCounter;
+
+void Bench_Init()
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    for (volatile int i = 0; i < 16; i++);
+    // reads as zero if the counter is not implemented
+    s_cycleCounter = DWT->CYCCNT != 0;
+}
+
+uint32_t Bench_Cycles()
+{
+    if (s_cycleCounter)
+    {
+        return DWT->CYCCNT;
+    }
+
+    // semihosting clock runs in nanoseconds
+    return uint32_t(angel_clock() * (SystemCoreClock / 1000000) / 1000);
+}
+
+void Bench_Report(const char* name, uint32_t value)
+{
+    printf("%s.%s,%u\n", Bench_Variant, name, unsigned(value));
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        // the last argument is the variant, preceded by the kernel name
+        Bench_Variant = argv[argc - 1];
+    }
+
+    Bench_Init();
+#if CORTEX_BOOT_PROFILE
+    Bench_Report("boot_main", __boot_profile.main);
+#endif
+    Bench_Heap();
+    Bench_IRQ();
+
+    kernel::Task::Run(Bench_Workers);
+    kernel::Scheduler::Main().Run();
+    return 0;
+}
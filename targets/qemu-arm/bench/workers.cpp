@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2026 triaxis s.r.o.
+ * Licensed under the MIT license. See LICENSE.txt file in the repository root
+ * for full license information.
+ *
+ * qemu-arm/bench/workers.cpp
+ *
+ * Worker context switching benchmarks
+ *
+ * worker_yield      worker -> main loop -> worker round trip through the SVC handler
+ * worker_preempt    the same round trip forced by SysTick (PendSV with CORTEX_WORKER_SCHEDULER)
+ * worker_create     starting and tearing down an empty worker, including its stack allocation
+ *
+ * The scheduler variant is built with CORTEX_WORKER_SCHEDULER, the other ones switch without it
+ */
+
+#include "bench.h"
+
+#ifndef BENCH_WORKER_ROUNDS
+#define BENCH_WORKER_ROUNDS     1000
+#endif
+
+static intptr_t YieldLoop(uint32_t rounds)
+{
+    for (uint32_t i = 0; i < rounds; i++)
+    {
+        kernel::Worker::Yield(_ASYNC_RES(0, AsyncResult::SleepTicks));
+    }
+    return 0;
+}
+
+static intptr_t PreemptLoop(uint32_t rounds)
+{
+    for (uint32_t i = 0; i < rounds; i++)
+    {
+        // taken immediately, the worker is switched out as if its time slice was over
+        kernel::Worker::Preempt();
+    }
+    return 0;
+}
+
+static intptr_t Empty()
+{
+    return 0;
+}
+
+async(Bench_Workers)
+async_def(
+    uint32_t t;
+    uint32_t i;
+)
+{
+    f.t = Bench_Cycles();
+    await(kernel::Worker::Run, YieldLoop, uint32_t(BENCH_WORKER_ROUNDS));
+    Bench_Report("worker_yield", (Bench_Cycles() - f.t) / BENCH_WORKER_ROUNDS);
+
+    f.t = Bench_Cycles();
+    await(kernel::Worker::Run, PreemptLoop, uint32_t(BENCH_WORKER_ROUNDS));
+    Bench_Report("worker_preempt", (Bench_Cycles() - f.t) / BENCH_WORKER_ROUNDS);
+
+    f.t = Bench_Cycles();
+    for (f.i = 0; f.i < BENCH_WORKER_ROUNDS; f.i++)
+    {
+        await(kernel::Worker::Run, Empty);
+    }
+    Bench_Report("worker_create", (Bench_Cycles() - f.t) / BENCH_WORKER_ROUNDS);
+
+    exit(0);
+}
+async_end